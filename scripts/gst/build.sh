@@ -20,13 +20,16 @@ fi
 #	-Dgst-plugins-base:vorbis=enabled \
 meson ${PARAMS} --prefix=/usr/local -Dintrospection=disabled -Dauto_features=disabled -Dgood=enabled \
 	-Dgst-plugins-base:alsa=enabled \
+	-Dgst-plugins-base:app=enabled \
 	-Dgst-plugins-base:ogg=enabled \
+	-Dgst-plugins-base:opus=enabled \
 	-Dgst-plugins-base:playback=enabled \
 	-Dgst-plugins-base:typefind=enabled \
 	-Dgst-plugins-base:volume=enabled \
 	-Dgst-plugins-base:vorbis=enabled \
 	-Dgst-plugins-base:audioconvert=enabled \
 	-Dgst-plugins-base:audioresample=enabled \
+	-Dgst-plugins-base:audiomixer=enabled \
 	-Dgst-plugins-good:autodetect=enabled \
 	-Dgst-plugins-good:audioparsers=enabled \
 	-Dgst-plugins-good:wavparse=enabled \
@@ -37,10 +40,5 @@ meson ${PARAMS} --prefix=/usr/local -Dintrospection=disabled -Dauto_features=dis
 	-Dgst-plugins-good:icydemux=enabled \
 	build
 
-# patch for souphttpsrc
-cd subprojects/gst-plugins-good
-patch -p1 < "../../../../../scripts/gst/gst-plugin-souphttpsrc-postdata.patch"
-cd ../../
-
 ninja -C build
 ninja -C build install
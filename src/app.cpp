@@ -16,8 +16,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <cxxabi.h>
 #include <glib-unix.h>
 #include <glib.h>
+#include <stdlib.h>
 
 #include "app.hpp"
 #include "audio/audioinput.hpp"
@@ -28,10 +30,13 @@
 #include "utils/net.hpp"
 #include "evinput.hpp"
 #include "leds.hpp"
+#include "metrics.hpp"
 #include "spotifyd.hpp"
+#include "stats.hpp"
 #include "stt.hpp"
 #include "webserver.hpp"
 #include "ws-protocol/client.hpp"
+#include <future>
 
 double time_diff(struct timeval x, struct timeval y) {
   return (((double)y.tv_sec * 1000000 + (double)y.tv_usec) -
@@ -42,7 +47,7 @@ double time_diff_ms(struct timeval x, struct timeval y) {
   return time_diff(x, y) / 1000;
 }
 
-genie::App::App() {
+genie::App::App() : event_queue(this) {
   main_thread = std::this_thread::get_id();
   is_processing = FALSE;
 }
@@ -105,7 +110,23 @@ int genie::App::process_args(int argc, char *argv[]) {
   return true;
 }
 
+/**
+ * @brief Log how long component `name` took to initialize since `t_start`,
+ * and export it as a metric. Thread-safe.
+ */
+static void startup_done(genie::Metrics *metrics, const char *name,
+                         gint64 t_start) {
+  gint64 elapsed_us = g_get_monotonic_time() - t_start;
+  g_message("Initialized %s in %.1f ms", name, elapsed_us / 1000.0);
+  metrics
+      ->gauge("genie_startup_seconds",
+              "Time each component took to initialize, in seconds.",
+              std::string("component=\"") + name + "\"")
+      ->set(elapsed_us / (double)G_USEC_PER_SEC);
+}
+
 int genie::App::exec(int argc, char *argv[]) {
+  gint64 t_exec = g_get_monotonic_time();
   if (!process_args(argc, argv)) {
     return EXIT_FAILURE;
   }
@@ -120,32 +141,80 @@ int genie::App::exec(int argc, char *argv[]) {
   config = std::make_unique<Config>();
   config->load();
 
+  stats = std::make_unique<Stats>();
+  metrics = std::make_unique<Metrics>();
+  event_delay_metric = metrics->histogram(
+      "genie_event_delay_seconds",
+      "Time state events waited for the main loop, in seconds.");
+
+  if (config->trace_enabled) {
+    gchar *trace_dir =
+        g_build_filename(config->cache_dir, "traces", nullptr);
+    tracer = std::make_unique<Tracer>(trace_dir, config->trace_max_files);
+    g_free(trace_dir);
+  } else {
+    tracer = std::make_unique<Tracer>();
+  }
+
+  if (config->recorder_enabled) {
+    gchar *recorder_dir =
+        g_build_filename(config->cache_dir, "recordings", nullptr);
+    recorder = std::make_unique<FlightRecorder>(
+        recorder_dir, config->recorder_seconds, config->recorder_events,
+        config->recorder_max_dumps);
+    g_free(recorder_dir);
+  } else {
+    recorder = std::make_unique<FlightRecorder>();
+  }
+
+  watchdog = std::make_unique<Watchdog>(
+      this, config->watchdog_enabled ? config->watchdog_stall_ms : 0);
+
   init_soup();
 
+  // the environment must be set before any other thread starts
   g_setenv("PULSE_PROP_media.role", "voice-assistant", TRUE);
   g_setenv("GST_REGISTRY_UPDATE", "no", true);
 
+  // Startup runs in stages. The slow steps that depend on nothing else,
+  // loading the wake-word model and the GStreamer registry, run on their
+  // own threads. Meanwhile the main thread sets up the components that only
+  // need the main loop, and starts connecting to Genie. The audio
+  // components are created last, each as soon as its dependency is ready.
+  gint64 t_start = g_get_monotonic_time();
+  std::future<std::unique_ptr<WakeWord>> wakeword_task =
+      std::async(std::launch::async, [this, t_start]() {
+        auto wakeword = std::make_unique<WakeWord>(this);
+        startup_done(metrics.get(), "wakeword", t_start);
+        return wakeword;
+      });
+  std::future<void> gstreamer_task =
+      std::async(std::launch::async, [this, t_start]() {
+        AudioPlayer::init_gstreamer();
+        startup_done(metrics.get(), "gstreamer", t_start);
+      });
+
+  t_start = g_get_monotonic_time();
   leds = std::make_unique<Leds>(this);
   leds->init();
   leds->animate(LedsState_t::Starting);
+  startup_done(metrics.get(), "leds", t_start);
 
-  audio_volume_controller = std::make_unique<AudioVolumeController>(this);
-
-  audio_player = std::make_unique<AudioPlayer>(this);
-
-  stt = std::make_unique<STT>(this);
-
-  audio_input = std::make_unique<AudioInput>(this);
+  t_start = g_get_monotonic_time();
+  conversation_client = std::make_unique<conversation::Client>(this);
+  conversation_client->init();
+  startup_done(metrics.get(), "conversation", t_start);
 
+  t_start = g_get_monotonic_time();
   spotifyd = std::make_unique<Spotifyd>(this);
   spotifyd->init();
+  startup_done(metrics.get(), "spotifyd", t_start);
 
-  conversation_client = std::make_unique<conversation::Client>(this);
-  conversation_client->init();
-
+  t_start = g_get_monotonic_time();
+  audio_volume_controller = std::make_unique<AudioVolumeController>(this);
+  stt = std::make_unique<STT>(this);
   ev_input = std::make_unique<EVInput>(this);
   ev_input->init();
-
   webserver = std::make_unique<WebServer>(this);
 
   if (config->dns_controller_enabled) {
@@ -155,11 +224,26 @@ int genie::App::exec(int argc, char *argv[]) {
   if (config->net_controller_enabled) {
     net_controller = std::make_unique<NetController>(this);
   }
+  startup_done(metrics.get(), "services", t_start);
+
+  // the input only dispatches events, which wait for the main loop, so it
+  // can start listening while GStreamer is still loading
+  std::unique_ptr<WakeWord> wakeword = wakeword_task.get();
+  t_start = g_get_monotonic_time();
+  audio_input = std::make_unique<AudioInput>(this, std::move(wakeword));
+  startup_done(metrics.get(), "audio_input", t_start);
+
+  gstreamer_task.get();
+  t_start = g_get_monotonic_time();
+  audio_player = std::make_unique<AudioPlayer>(this);
+  startup_done(metrics.get(), "audio_player", t_start);
 
   this->current_state = new state::Sleeping(this);
   this->current_state->enter();
+  startup_done(metrics.get(), "total", t_exec);
 
   g_debug("start main loop\n");
+  watchdog->start();
   g_main_loop_run(main_loop);
   g_debug("main loop returned\n");
 
@@ -186,61 +270,124 @@ void genie::App::print_processing_entry(const char *name, double duration_ms,
           (int)((duration_ms / total_ms) * 100));
 }
 
+void genie::App::observe_turn_step(const char *step, gint64 duration_us) {
+  metrics
+      ->histogram("genie_turn_seconds",
+                  "Duration of the steps of completed turns, in seconds.",
+                  std::string("step=\"") + step + "\"")
+      ->observe(duration_us / (double)G_USEC_PER_SEC);
+}
+
 /**
  * @brief Track an event that is part of a turn's remote processing.
  *
  * We want to keep a close eye the performance of our
  *
+ * Each completed step is added to the trace of the turn as a span, and the
+ * breakdown of the whole turn is printed when it is done.
+ *
  * @param event_type
  */
-void genie::App::track_processing_event(ProcessingEventType event_type) {
+void genie::App::track_processing_event(ProcessingEventType event_type,
+                                        gint64 t_event) {
   // Unless we are starting a turn or already in a turn just bail out. This
   // avoids tracking the "Hi..." and any other messages at connect.
   if (!(event_type == ProcessingEventType::START_STT || is_processing)) {
     return;
   }
 
+  gint64 t = t_event ? t_event : g_get_monotonic_time();
+
   switch (event_type) {
     case ProcessingEventType::START_STT:
-      gettimeofday(&start_stt, NULL);
+      start_stt = t;
       is_processing = true;
+      if (tracer->turn_started())
+        tracer->span("turn.listening", tracer->turn_started(), t);
       break;
     case ProcessingEventType::END_STT:
-      gettimeofday(&end_stt, NULL);
+      end_stt = t;
+      tracer->span("turn.stt", start_stt, t);
       break;
     case ProcessingEventType::START_GENIE:
-      gettimeofday(&start_genie, NULL);
+      start_genie = t;
       break;
     case ProcessingEventType::END_GENIE:
-      gettimeofday(&end_genie, NULL);
+      end_genie = t;
+      tracer->span("turn.genie", start_genie, t);
       break;
     case ProcessingEventType::START_TTS:
-      gettimeofday(&start_tts, NULL);
+      start_tts = t;
       break;
     case ProcessingEventType::END_TTS:
-      gettimeofday(&end_tts, NULL);
+      end_tts = t;
+      tracer->span("turn.tts", start_tts, t);
       break;
     case ProcessingEventType::DONE:
-      int total_ms = time_diff_ms(start_stt, end_tts);
+      double total_ms = (end_tts - start_stt) / 1000.0;
 
       g_print("############# Processing Performance #################\n");
-      print_processing_entry("STT", time_diff_ms(start_stt, end_stt), total_ms);
-      print_processing_entry("STT->Genie", time_diff_ms(end_stt, start_genie),
+      print_processing_entry("STT", (end_stt - start_stt) / 1000.0, total_ms);
+      print_processing_entry("STT->Genie", (start_genie - end_stt) / 1000.0,
                              total_ms);
-      print_processing_entry("Genie", time_diff_ms(start_genie, end_genie),
+      print_processing_entry("Genie", (end_genie - start_genie) / 1000.0,
                              total_ms);
-      print_processing_entry("Genie->TTS", time_diff_ms(end_genie, start_tts),
+      print_processing_entry("Genie->TTS", (start_tts - end_genie) / 1000.0,
                              total_ms);
-      print_processing_entry("TTS", time_diff_ms(start_tts, end_tts), total_ms);
+      print_processing_entry("TTS", (end_tts - start_tts) / 1000.0, total_ms);
       g_print("------------------------------------------------------\n");
       print_processing_entry("Total", total_ms, total_ms);
       g_print("######################################################\n");
 
+      observe_turn_step("stt", end_stt - start_stt);
+      observe_turn_step("genie", end_genie - start_genie);
+      observe_turn_step("tts", end_tts - start_tts);
+      observe_turn_step("total", end_tts - start_stt);
+
       is_processing = false;
+      tracer->end_turn();
       break;
   }
 }
 
+std::string genie::App::event_type_name(const char *mangled_name) {
+  int status;
+  char *demangled =
+      abi::__cxa_demangle(mangled_name, nullptr, nullptr, &status);
+  std::string name(status == 0 ? demangled : mangled_name);
+  free(demangled);
+
+  // drop the namespaces
+  size_t sep = name.rfind("::");
+  if (sep != std::string::npos)
+    name = name.substr(sep + 2);
+  return name;
+}
+
+/**
+ * @brief Record how long an event waited between `dispatch()` and its
+ * handling on the main loop, under `stat` and across all the events.
+ *
+ * A long wait means something held the main loop, such as a blocking call
+ * or a slow bus callback, and delayed everything queued behind it.
+ */
+void genie::App::track_event_delay(const char *stat, gint64 t_queued) {
+  double delay_ms = (g_get_monotonic_time() - t_queued) / 1000.0;
+  stats->record(stat, delay_ms);
+  stats->record("events.delay_ms", delay_ms);
+  event_delay_metric->observe(delay_ms / 1000);
+
+  if (!config->event_delay_warn_ms)
+    return;
+  // warn once per stall, not for every event queued behind it
+  bool delayed = delay_ms > config->event_delay_warn_ms;
+  if (delayed && !events_delayed) {
+    g_warning("Event waited %.1f ms for the main loop (%s)", delay_ms, stat);
+    stats->log_summary("events.delay_ms");
+  }
+  events_delayed = delayed;
+}
+
 void genie::App::replay_deferred_events() {
   // steal all the deferred events
   // this is necessary because handling the event
@@ -251,9 +398,11 @@ void genie::App::replay_deferred_events() {
   // replay the events
   while (!copy.empty()) {
     auto &defer = copy.front();
-    current_event = defer.event;
+    state::events::Event *event = defer.event;
+    // deferring it again moves it out, the original is deleted either way
+    current_event = event;
     defer.dispatch(current_state);
-    delete current_event;
+    delete event;
     current_event = nullptr;
     copy.pop();
   }
@@ -21,17 +21,22 @@
 #include "config.h"
 
 #include "config.hpp"
+#include "flightrecorder.hpp"
+#include "tracer.hpp"
+#include "watchdog.hpp"
 #include "utils/autoptrs.hpp"
 #include <glib.h>
 #include <libsoup/soup.h>
 #include <memory>
 #include <queue>
+#include <string>
 #include <sys/time.h>
 #include <thread>
 
 #include "audio/audio.hpp"
 
 #include "state/disabled.hpp"
+#include "state/eventqueue.hpp"
 #include "state/events.hpp"
 #include "state/listening.hpp"
 #include "state/processing.hpp"
@@ -69,8 +74,11 @@ class AudioFIFO;
 class AudioPlayer;
 class AudioVolumeController;
 class EVInput;
+class Histogram;
 class Leds;
+class Metrics;
 class Spotifyd;
+class Stats;
 class STT;
 class TTS;
 class DNSController;
@@ -115,31 +123,42 @@ public:
   // -------------------------------------------------------------------------
 
   std::unique_ptr<Config> config;
+  std::unique_ptr<Stats> stats;
+  std::unique_ptr<Metrics> metrics;
+  std::unique_ptr<Tracer> tracer;
+  std::unique_ptr<FlightRecorder> recorder;
+  std::unique_ptr<Watchdog> watchdog;
 
   // Public Instance Methods
   // ---------------------------------------------------------------------------
 
   int exec(int argc, char *argv[]);
-  void track_processing_event(ProcessingEventType eventType);
 
   /**
-   * @brief Dispatch a state `event`. This method is _thread-safe_.
-   *
-   * When called it queues handling of the `event` on the main thread via
-   * [g_idle_add](https://docs.gtk.org/glib/func.idle_add.html).
+   * @brief Record a step of the current turn, at `t_event` (monotonic time,
+   * in microseconds) if given, otherwise at the current time.
+   */
+  void track_processing_event(ProcessingEventType eventType,
+                              gint64 t_event = 0);
+
+  /**
+   * @brief Dispatch a state event of type `E`, constructed from `args`. This
+   * method is _thread-safe_.
    *
-   * After the `event` is handled it is deleted.
+   * The event is constructed in the slot of `event_queue`, which hands it to
+   * `handle()` on the main thread, and destroys it afterwards.
    */
-  template <typename E> guint dispatch(E *event) {
-    g_debug("DISPATCH EVENT %s", typeid(E).name());
-    DispatchUserData *dispatch_user_data = new DispatchUserData(this, event);
-    return g_idle_add(handle<E>, dispatch_user_data);
+  template <typename E, typename... Args> void dispatch(Args &&...args) {
+    event_queue.push<E>(handle<E>, std::forward<Args>(args)...);
   }
 
   SoupSession *get_soup_session() { return soup_session.get(); }
 
   /**
    * Defer the handling of this event until the next state.
+   *
+   * The event is moved out, since the original is destroyed once its
+   * handler returns.
    */
   template <typename E> void defer(E *event) {
     if (event != current_event) {
@@ -147,7 +166,7 @@ public:
       return;
     }
     current_event = nullptr;
-    deferred_events.emplace(event);
+    deferred_events.emplace(new E(std::move(*event)));
   }
 
   void force_reconnect();
@@ -160,33 +179,14 @@ public:
 private:
   // =========================================================================
 
-  // Private Structures
-  // -------------------------------------------------------------------------
-
-  /**
-   * @brief Structure passed as `user_data` through the GLib main loop when
-   * dispatching an event.
-   *
-   * Contains a pointer to the app instance and a pointer to the event being
-   * dispatched.
-   *
-   * After the event is handled the structure is deleted, which in turn
-   * deletes the referenced event.
-   */
-  struct DispatchUserData {
-    App *app;
-    state::events::Event *event;
-
-    DispatchUserData(App *app, state::events::Event *event)
-        : app(app), event(event) {}
-    ~DispatchUserData() { delete event; }
-  };
-
   // Private Instance Members
   // -------------------------------------------------------------------------
 
   std::thread::id main_thread;
   GMainLoop *main_loop;
+  state::EventQueue event_queue;
+  // the last event handled waited longer than `event_delay_warn_ms`
+  bool events_delayed = false;
   auto_gobject_ptr<SoupSession> soup_session;
 
   // ### Component Instances ###
@@ -205,12 +205,13 @@ private:
   // ### Performance Tracking ###
 
   bool is_processing;
-  struct timeval start_stt;
-  struct timeval end_stt;
-  struct timeval start_genie;
-  struct timeval end_genie;
-  struct timeval start_tts;
-  struct timeval end_tts;
+  // monotonic times of the steps of the current turn, in microseconds
+  gint64 start_stt;
+  gint64 end_stt;
+  gint64 start_genie;
+  gint64 end_genie;
+  gint64 start_tts;
+  gint64 end_tts;
 
   // ### State Variables ###
 
@@ -283,32 +284,41 @@ private:
 
   void print_processing_entry(const char *name, double duration_ms,
                               double total_ms);
+  void observe_turn_step(const char *step, gint64 duration_us);
   void replay_deferred_events();
 
   /**
-   * @brief GLib main loop callback for dispatching state events.
+   * @brief Unqualified name of the event type named `mangled_name`, as
+   * returned by `typeid().name()`.
+   */
+  static std::string event_type_name(const char *mangled_name);
+  void track_event_delay(const char *stat, gint64 t_queued);
+  Histogram *event_delay_metric = nullptr;
+
+  /**
+   * @brief Event queue handler for state events of type `E`.
    *
-   * `dispatch()` queues a call to this static method, passing a pointer to a
-   * `DispatchUserData` structure that contains pointers to the `App` instance
-   * and the dispatched `state::events::Event`.
+   * `dispatch()` queues the event with this static method, which the queue
+   * calls on the main thread with the `App` instance.
    *
    * This method calls `state::State::react()` on the `current_state` with
-   * the `state::events::Event`, then deletes the event.
+   * the `state::events::Event`, in a trace span named after the event type.
+   * The queue destroys the event afterwards.
    */
-  template <typename E> static gboolean handle(gpointer user_data) {
+  template <typename E>
+  static void handle(gpointer user_data, state::events::Event *event,
+                     gint64 t_queued) {
     g_debug("HANDLE EVENT %s", typeid(E).name());
-    DispatchUserData *dispatch_user_data =
-        static_cast<DispatchUserData *>(user_data);
-    App *self = dispatch_user_data->app;
-    E *event = static_cast<E *>(dispatch_user_data->event);
-    // steal the event so we won't free it and the state can defer it
+    App *self = static_cast<App *>(user_data);
+    static const std::string type_name = event_type_name(typeid(E).name());
+    static const std::string delay_stat = "events." + type_name + ".delay_ms";
+    self->track_event_delay(delay_stat.c_str(), t_queued);
+    TraceSpan span(self->tracer.get(), type_name.c_str());
+    self->recorder->record_event("event", type_name.c_str());
+    // the state can defer the current event
     self->current_event = event;
-    dispatch_user_data->event = nullptr;
-    self->current_state->react(event);
-    delete self->current_event;
+    self->current_state->react(static_cast<E *>(event));
     self->current_event = nullptr;
-    delete dispatch_user_data;
-    return false;
   }
 
   /**
@@ -323,6 +333,7 @@ private:
   template <typename S> void transit(S *new_state) {
     g_assert(std::this_thread::get_id() == main_thread);
     g_message("TRANSIT to %s", S::NAME);
+    recorder->record_event("state", S::NAME);
     current_state->exit();
     delete current_state;
     current_state = new_state;
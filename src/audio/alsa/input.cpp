@@ -17,18 +17,12 @@
 // limitations under the License.
 
 #include "input.hpp"
+#include "../../metrics.hpp"
 
-// Define the following to dump audio streams for debugging reasons
-// #define DEBUG_DUMP_STREAMS
-
-#ifdef DEBUG_DUMP_STREAMS
-FILE *fp_input;
-FILE *fp_input_mono;
-FILE *fp_playback;
-FILE *fp_filter;
-#endif
-
-genie::AudioInputAlsa::AudioInputAlsa(App *app) : app(app) {}
+genie::AudioInputAlsa::AudioInputAlsa(App *app)
+    : app(app), overrun_metric(app->metrics->counter(
+                    "genie_capture_overruns_total",
+                    "Capture buffer overruns, where input audio was lost.")) {}
 
 genie::AudioInputAlsa::~AudioInputAlsa() {
   free(pcm);
@@ -38,12 +32,6 @@ genie::AudioInputAlsa::~AudioInputAlsa() {
   if (alsa_handle != NULL) {
     snd_pcm_close(alsa_handle);
   }
-#ifdef DEBUG_DUMP_STREAMS
-  fclose(fp_input);
-  fclose(fp_input_mono);
-  fclose(fp_playback);
-  fclose(fp_filter);
-#endif
 }
 
 bool genie::AudioInputAlsa::init_pcm(gchar *input_audio_device) {
@@ -175,12 +163,6 @@ bool genie::AudioInputAlsa::init(gchar *audio_input_device, int m_sample_rate,
     }
   }
 
-#ifdef DEBUG_DUMP_STREAMS
-  fp_input = fopen("/tmp/input.raw", "wb+");
-  fp_input_mono = fopen("/tmp/input_mono.raw", "wb+");
-  fp_playback = fopen("/tmp/playback.raw", "wb+");
-  fp_filter = fopen("/tmp/filter.raw", "wb+");
-#endif
   pcm = (int16_t *)malloc(max_frame_length * channels * sizeof(int16_t));
   if (!pcm) {
     g_error("failed to allocate memory for audio buffer\n");
@@ -214,6 +196,14 @@ genie::AudioFrame genie::AudioInputAlsa::read_frame(int32_t frame_length) {
 
   if (alsa_handle != NULL) {
     read_frames = snd_pcm_readi(alsa_handle, pcm, frame_length);
+    if (read_frames == -EPIPE) {
+      // the input thread fell behind and the device dropped audio, restart
+      // the capture instead of failing every read from now on
+      overrun_metric->inc();
+      g_warning("Capture overrun");
+      snd_pcm_prepare(alsa_handle);
+      return AudioFrame(0);
+    }
     if (read_frames < 0) {
       g_critical("'snd_pcm_readi' failed with '%s'", snd_strerror(read_frames));
       return AudioFrame(0);
@@ -255,23 +245,17 @@ genie::AudioFrame genie::AudioInputAlsa::read_frame(int32_t frame_length) {
       if (pp_state) {
         speex_preprocess_run(pp_state, (spx_int16_t *)pcm_filter);
       }
-
-#ifdef DEBUG_DUMP_STREAMS
-      fwrite(pcm_playback, sizeof(int16_t), frame_length, fp_playback);
-      fwrite(pcm_filter, sizeof(int16_t), frame_length, fp_filter);
-#endif
       pcm_out = pcm_filter;
     } else {
       pcm_out = pcm_mono;
     }
-#ifdef DEBUG_DUMP_STREAMS
-    fwrite(pcm_mono, sizeof(int16_t), frame_length, fp_input_mono);
-#endif
-  }
 
-#ifdef DEBUG_DUMP_STREAMS
-  fwrite(pcm, sizeof(int16_t), frame_length * channels, fp_input);
-#endif
+    app->recorder->record_audio(FlightRecorder::Track::MIC, pcm_mono,
+                                frame_length);
+    if (app->config->audio_ec_loopback && channels == 3)
+      app->recorder->record_audio(FlightRecorder::Track::PLAYBACK,
+                                  pcm_playback, frame_length);
+  }
 
   AudioFrame frame(frame_length);
   memcpy(frame.samples, pcm_out, frame_length * sizeof(int16_t));
@@ -28,6 +28,8 @@
 
 namespace genie {
 
+class Counter;
+
 class AudioInputAlsa : public AudioInputDriver {
 public:
   AudioInputAlsa(App *app);
@@ -39,6 +41,7 @@ public:
 private:
   // initialized once and never overwritten
   App *const app;
+  Counter *const overrun_metric;
   snd_pcm_t *alsa_handle = NULL;
 
   bool init_pcm(gchar *input_audio_device);
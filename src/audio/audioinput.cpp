@@ -18,6 +18,7 @@
 
 #include "audioinput.hpp"
 #include "alsa/input.hpp"
+#include "metrics.hpp"
 #include "pulseaudio/input.hpp"
 
 // note: we need to redefine G_LOG_DOMAIN here or the definition will
@@ -26,11 +27,15 @@
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "genie::AudioInput"
 
-genie::AudioInput::AudioInput(App *app)
-    : app(app), vad_instance(WebRtcVad_Create()), wakeword(nullptr),
-      input(nullptr), state(State::WAITING) {
-  wakeword = std::make_unique<WakeWord>(app);
-
+genie::AudioInput::AudioInput(App *app, std::unique_ptr<WakeWord> engine)
+    : app(app), vad_instance(WebRtcVad_Create()), wakeword(std::move(engine)),
+      input(nullptr),
+      wakeword_metric(app->metrics->counter(
+          "genie_wakeword_detections_total", "Wake-word detections.")),
+      false_wake_metric(app->metrics->counter(
+          "genie_false_wakes_total",
+          "Wake-ups that were not followed by speech.")),
+      state(State::WAITING) {
   sample_rate = wakeword->sample_rate;
   pv_frame_length = wakeword->pv_frame_length;
   int32_t max_frame_length =
@@ -89,7 +94,23 @@ genie::AudioInput::AudioInput(App *app)
             "-> %zd frames",
             app->config->vad_listen_timeout_ms, vad_listen_timeout_frame_count);
 
+  trim_silence = app->config->vad_trim_silence;
+  trim_guard_frame_count = ms_to_frames(AUDIO_INPUT_VAD_FRAME_LENGTH,
+                                        app->config->vad_trim_guard_ms);
+  trim_trailing_frame_count = ms_to_frames(AUDIO_INPUT_VAD_FRAME_LENGTH,
+                                           app->config->vad_trim_trailing_ms);
+  if (trim_silence) {
+    g_message("Trimming silence, keeping %zd guard frames and %zd trailing "
+              "frames",
+              trim_guard_frame_count, trim_trailing_frame_count);
+  }
+
+  state_speech_started = false;
+  state_trimmed_frame_count = 0;
+  state_t_entered = 0;
+
   g_message("Initialized audio input with %s backend\n", audio_driver_type_to_string(app->config->audio_backend));
+  app->recorder->start_audio(sample_rate);
   input_thread = std::thread(&AudioInput::loop, this);
 }
 
@@ -131,7 +152,8 @@ void genie::AudioInput::wake() {
   // else, this should be all we need -- we don't care that `expect` gets set
   // to something else when `this->state` was not `State::WAITING`.
   //
-  state.compare_exchange_strong(expect, State::WOKE);
+  if (state.compare_exchange_strong(expect, State::WOKE))
+    app->tracer->instant("input.wake");
 }
 
 /**
@@ -150,23 +172,91 @@ size_t genie::AudioInput::ms_to_frames(size_t frame_length, size_t ms) {
   return (size_t)((sample_rate * ((double)ms / 1000)) / frame_length);
 }
 
+/**
+ * @brief Read a frame from the driver, and keep it in the flight recorder.
+ */
+genie::AudioFrame genie::AudioInput::read_frame(size_t frame_length) {
+  AudioFrame frame = input->read_frame(frame_length);
+  app->recorder->record_audio(FlightRecorder::Track::INPUT, frame.samples,
+                              frame.length);
+  return frame;
+}
+
+/**
+ * @brief Send an audio frame to the main thread, to be streamed to STT.
+ */
+void genie::AudioInput::send_frame(AudioFrame frame) {
+  app->dispatch<state::events::InputFrame>(std::move(frame));
+}
+
+/**
+ * @brief Hold back a (silent) frame instead of sending it, keeping at most
+ * `max_held` frames. Older frames are dropped.
+ */
+void genie::AudioInput::hold_frame(AudioFrame frame, size_t max_held) {
+  trim_buffer.push_back(std::move(frame));
+  while (trim_buffer.size() > max_held) {
+    trim_buffer.pop_front();
+    state_trimmed_frame_count += 1;
+  }
+}
+
+/**
+ * @brief Send all the frames that were held back, in order.
+ */
+void genie::AudioInput::flush_held_frames() {
+  while (!trim_buffer.empty()) {
+    send_frame(std::move(trim_buffer.front()));
+    trim_buffer.pop_front();
+  }
+}
+
+/**
+ * @brief Drop all the frames that were held back, and report how much audio
+ * was kept from being streamed in this turn.
+ */
+void genie::AudioInput::drop_held_frames() {
+  state_trimmed_frame_count += trim_buffer.size();
+  trim_buffer.clear();
+
+  if (state_trimmed_frame_count > 0) {
+    g_message("Trimmed %zu silent frames (~%zu ms) from STT input",
+              state_trimmed_frame_count,
+              state_trimmed_frame_count * AUDIO_INPUT_VAD_FRAME_LENGTH * 1000 /
+                  sample_rate);
+  }
+  state_trimmed_frame_count = 0;
+}
+
 void genie::AudioInput::transition(State to_state) {
+  Tracer *tracer = app->tracer.get();
+  if (state == State::WOKE)
+    tracer->span("vad.wait_speech", state_t_entered);
+  else if (state == State::LISTENING)
+    tracer->span("vad.listening", state_t_entered);
+  state_t_entered = tracer->now();
+
   // Reset state variables
   state_woke_frame_count = 0;
   state_vad_silent_count = 0;
   state_vad_noise_count = 0;
+  state_speech_started = false;
 
   switch (to_state) {
     case State::WAITING:
       g_message("[AudioInput] -> State::WAITING");
+      app->recorder->record_event("input", "WAITING");
+      drop_held_frames();
       state = State::WAITING;
       break;
     case State::WOKE:
       g_message("[AudioInput] -> State::WOKE");
+      app->recorder->record_event("input", "WOKE");
       state = State::WOKE;
       break;
     case State::LISTENING:
       g_message("[AudioInput] -> State::LISTENING");
+      app->recorder->record_event("input", "LISTENING");
       state = State::LISTENING;
       break;
     case State::CLOSED:
@@ -177,7 +267,7 @@ void genie::AudioInput::transition(State to_state) {
 }
 
 void genie::AudioInput::loop_waiting() {
-  AudioFrame new_frame = input->read_frame(pv_frame_length);
+  AudioFrame new_frame = read_frame(pv_frame_length);
 
   if (new_frame.length == 0) {
     return;
@@ -200,13 +290,15 @@ void genie::AudioInput::loop_waiting() {
   }
 
   g_message("Wakeword detected in waiting state");
-  app->dispatch(new state::events::Wake());
+  app->tracer->instant("wakeword");
+  app->recorder->record_event("input", "wakeword");
+  wakeword_metric->inc();
+  app->dispatch<state::events::Wake>();
 
   g_debug("Sending prior %zd frames\n", frame_buffer.size());
 
   while (!frame_buffer.empty()) {
-    app->dispatch(
-        new state::events::InputFrame(std::move(frame_buffer.front())));
+    send_frame(std::move(frame_buffer.front()));
     frame_buffer.pop();
   }
 
@@ -214,12 +306,16 @@ void genie::AudioInput::loop_waiting() {
 }
 
 void genie::AudioInput::loop_woke() {
-  AudioFrame new_frame = input->read_frame(AUDIO_INPUT_VAD_FRAME_LENGTH);
+  AudioFrame new_frame = read_frame(AUDIO_INPUT_VAD_FRAME_LENGTH);
 
   if (new_frame.length == 0) {
     return;
   }
 
+  // wake() moves to WOKE without a transition, time the state from its
+  // first frame instead
+  if (state_woke_frame_count == 0)
+    state_t_entered = app->tracer->now();
   state_woke_frame_count += 1;
 
   // Run Voice Activity Detection (VAD) against the frame
@@ -230,7 +326,18 @@ void genie::AudioInput::loop_woke() {
       WebRtcVad_Process(vad_instance, sample_rate, new_frame.samples,
                         AUDIO_INPUT_VAD_FRAME_LENGTH);
 
-  app->dispatch(new state::events::InputFrame(std::move(new_frame)));
+  if (!trim_silence) {
+    send_frame(std::move(new_frame));
+  } else if (state_speech_started || vad_result == VAD_NOT_SILENT) {
+    // Speech onset: send the guard frames we held back before it, then
+    // everything else until the end of the turn
+    state_speech_started = true;
+    flush_held_frames();
+    send_frame(std::move(new_frame));
+  } else {
+    // Leading silence, keep only the most recent frames as guard
+    hold_frame(std::move(new_frame), trim_guard_frame_count);
+  }
 
   if (vad_result == VAD_IS_SILENT) {
     g_debug("Frame %zu is silent in woke state (silent: %zu, noise: %zu)",
@@ -268,13 +375,14 @@ void genie::AudioInput::loop_woke() {
   if (state_woke_frame_count >= vad_start_frame_count) {
     g_debug("Not detected VAD input after %zu frames", vad_start_frame_count);
     // We have not detected speech over the start frame count, give up
-    app->dispatch(new state::events::InputDone(false));
+    false_wake_metric->inc();
+    app->dispatch<state::events::InputDone>(false);
     transition(State::WAITING);
   }
 }
 
 void genie::AudioInput::loop_listening() {
-  AudioFrame new_frame = input->read_frame(AUDIO_INPUT_VAD_FRAME_LENGTH);
+  AudioFrame new_frame = read_frame(AUDIO_INPUT_VAD_FRAME_LENGTH);
 
   if (new_frame.length == 0) {
     return;
@@ -289,8 +397,6 @@ void genie::AudioInput::loop_listening() {
   int silence = WebRtcVad_Process(vad_instance, sample_rate, new_frame.samples,
                                   AUDIO_INPUT_VAD_FRAME_LENGTH);
 
-  app->dispatch(new state::events::InputFrame(std::move(new_frame)));
-
   if (silence == VAD_IS_SILENT) {
     g_debug("Frame %zu is silent in listening state (silent: %zu, noise: %zu)",
             state_woke_frame_count, state_vad_silent_count,
@@ -302,15 +408,25 @@ void genie::AudioInput::loop_listening() {
         state_woke_frame_count, state_vad_silent_count, state_vad_noise_count);
     state_vad_silent_count = 0;
   }
+
+  if (trim_silence && state_vad_silent_count > trim_trailing_frame_count) {
+    // Endpointing is likely, stop streaming the trailing silence. The frames
+    // are held so they can still be sent if speech resumes.
+    hold_frame(std::move(new_frame), vad_done_frame_count);
+  } else {
+    flush_held_frames();
+    send_frame(std::move(new_frame));
+  }
+
   if (state_vad_silent_count >= vad_done_frame_count) {
     g_debug("Detected %zu frames of silence, VAD done", state_vad_silent_count);
-    app->dispatch(new state::events::InputDone(true));
+    app->dispatch<state::events::InputDone>(true);
     transition(State::WAITING);
   } else if (state_woke_frame_count >= vad_listen_timeout_frame_count) {
     g_message("LISTENING timed out after %zu frames (~%zu ms)",
               vad_listen_timeout_frame_count,
               app->config->vad_listen_timeout_ms);
-    app->dispatch(new state::events::InputDone(true));
+    app->dispatch<state::events::InputDone>(true, true);
     transition(State::WAITING);
   }
 }
@@ -25,6 +25,7 @@
 #include "utils/webrtc_vad.h"
 #include "wakeword.hpp"
 #include <atomic>
+#include <deque>
 #include <glib.h>
 #include <queue>
 #include <thread>
@@ -33,6 +34,8 @@
 
 namespace genie {
 
+class Counter;
+
 class AudioInput {
 public:
   static const int32_t BUFFER_MAX_FRAMES = 32;
@@ -47,7 +50,11 @@ public:
     LISTENING,
   };
 
-  AudioInput(App *app);
+  /**
+   * @brief Open the input device and start the input thread, with an
+   * already loaded wake-word engine.
+   */
+  AudioInput(App *app, std::unique_ptr<WakeWord> engine);
   ~AudioInput();
   void close();
   void wake();
@@ -58,6 +65,8 @@ private:
   VadInst *const vad_instance;
   std::unique_ptr<WakeWord> wakeword;
   std::unique_ptr<AudioInputDriver> input;
+  Counter *const wakeword_metric;
+  Counter *const false_wake_metric;
 
   // thread safe, accessed from both threads
   std::thread input_thread;
@@ -74,12 +83,27 @@ private:
   size_t vad_input_detected_noise_frame_count;
   size_t vad_listen_timeout_frame_count;
 
+  // Silence trimming
+  bool trim_silence;
+  size_t trim_guard_frame_count;
+  size_t trim_trailing_frame_count;
+  std::deque<AudioFrame> trim_buffer;
+
   // Loop state variables
   size_t state_woke_frame_count;
   size_t state_vad_silent_count;
   size_t state_vad_noise_count;
+  bool state_speech_started;
+  size_t state_trimmed_frame_count;
+  // start of the WOKE or LISTENING state, for tracing
+  gint64 state_t_entered;
 
   size_t ms_to_frames(size_t frame_length, size_t ms);
+  AudioFrame read_frame(size_t frame_length);
+  void send_frame(AudioFrame frame);
+  void hold_frame(AudioFrame frame, size_t max_held);
+  void flush_held_frames();
+  void drop_held_frames();
   void loop();
   void loop_waiting();
   void loop_woke();
@@ -0,0 +1,368 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "audiooutput.hpp"
+
+#include <gst/controller/gstdirectcontrolbinding.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::AudioOutput"
+
+static const char *destination_name(genie::AudioDestination destination) {
+  switch (destination) {
+    case genie::AudioDestination::VOICE:
+      return "voice";
+    case genie::AudioDestination::MUSIC:
+      return "music";
+    case genie::AudioDestination::ALERT:
+      return "alert";
+  }
+  return "unknown";
+}
+
+genie::AudioOutput::AudioOutput(App *app, const char *name,
+                                const char *device, size_t idle_timeout_ms)
+    : app(app), name(name), idle_timeout_ms(idle_timeout_ms),
+      bus_watch_id(0), idle_timeout_id(0), users(0), running(false) {
+  gchar *pipeline_name = g_strdup_printf("audio-output-%s", name);
+  pipeline = auto_gobject_ptr<GstElement>(gst_pipeline_new(pipeline_name),
+                                          adopt_mode::ref_sink);
+  g_free(pipeline_name);
+
+  mixer = auto_gobject_ptr<GstElement>(
+      gst_element_factory_make("audiomixer", nullptr), adopt_mode::ref_sink);
+  auto filter = gst_element_factory_make("capsfilter", nullptr);
+  auto convert = gst_element_factory_make("audioconvert", nullptr);
+  auto resample = gst_element_factory_make("audioresample", nullptr);
+  auto sink = gst_element_factory_make(app->config->audio_sink, nullptr);
+
+  if (!pipeline || !mixer || !filter || !convert || !resample || !sink) {
+    g_error("Gst element could not be created\n");
+  }
+
+  GstCaps *caps = make_caps();
+  g_object_set(G_OBJECT(filter), "caps", caps, NULL);
+  gst_caps_unref(caps);
+
+  if (device) {
+    g_object_set(G_OBJECT(sink), "device", device, NULL);
+  }
+
+  gst_bin_add_many(GST_BIN(pipeline.get()), mixer.get(), filter, convert,
+                   resample, sink, NULL);
+  gst_element_link_many(mixer.get(), filter, convert, resample, sink, NULL);
+
+  GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline.get()));
+  bus_watch_id = gst_bus_add_watch(bus, bus_call, this);
+  gst_object_unref(bus);
+}
+
+genie::AudioOutput::~AudioOutput() {
+  if (idle_timeout_id)
+    g_source_remove(idle_timeout_id);
+  g_source_remove(bus_watch_id);
+  gst_element_set_state(pipeline.get(), GST_STATE_NULL);
+}
+
+GstCaps *genie::AudioOutput::make_caps() {
+  return gst_caps_new_simple("audio/x-raw", "format", G_TYPE_STRING, "S16LE",
+                             "layout", G_TYPE_STRING, "interleaved", "rate",
+                             G_TYPE_INT, RATE, "channels", G_TYPE_INT,
+                             CHANNELS, nullptr);
+}
+
+void genie::AudioOutput::start() {
+  g_debug("Starting output %s", name.c_str());
+  gst_element_set_state(pipeline.get(), GST_STATE_PLAYING);
+  running = true;
+}
+
+void genie::AudioOutput::stop() {
+  g_debug("Stopping output %s", name.c_str());
+  gst_element_set_state(pipeline.get(), GST_STATE_NULL);
+  running = false;
+  reset_timestamps();
+
+  // the running time starts over when the output comes back up, settle the
+  // volume ramps
+  for (auto &it : branches) {
+    Branch *branch = it.second.get();
+    auto control = GST_TIMED_VALUE_CONTROL_SOURCE(branch->volume_control.get());
+    gst_timed_value_control_source_unset_all(control);
+    gst_timed_value_control_source_set(control, 0, branch->target_volume);
+  }
+}
+
+void genie::AudioOutput::reset_timestamps() {
+  std::lock_guard<std::mutex> lock(timestamp_mutex);
+  for (auto &it : branches)
+    it.second->next_timestamp = 0;
+}
+
+void genie::AudioOutput::acquire() {
+  if (idle_timeout_id) {
+    g_source_remove(idle_timeout_id);
+    idle_timeout_id = 0;
+  }
+
+  users++;
+  // also restarts the output after an error
+  if (!running)
+    start();
+}
+
+void genie::AudioOutput::release() {
+  g_return_if_fail(users > 0);
+  if (--users > 0)
+    return;
+
+  idle_timeout_id = g_timeout_add(
+      idle_timeout_ms,
+      [](gpointer data) {
+        AudioOutput *self = static_cast<AudioOutput *>(data);
+        self->idle_timeout_id = 0;
+        self->stop();
+        return G_SOURCE_REMOVE;
+      },
+      this);
+}
+
+bool genie::AudioOutput::has_branch(AudioDestination destination) const {
+  return branches.count(destination) > 0;
+}
+
+GstElement *genie::AudioOutput::add_branch(AudioDestination destination) {
+  g_return_val_if_fail(!has_branch(destination), nullptr);
+
+  const char *dest_name = destination_name(destination);
+  gchar *src_name = g_strdup_printf("%s-source", dest_name);
+  gchar *queue_name = g_strdup_printf("%s-queue", dest_name);
+  gchar *volume_name = g_strdup_printf("%s-volume", dest_name);
+
+  auto branch = std::make_unique<Branch>(this);
+  branch->appsrc = auto_gobject_ptr<GstElement>(
+      gst_element_factory_make("appsrc", src_name), adopt_mode::ref_sink);
+  branch->queue = auto_gobject_ptr<GstElement>(
+      gst_element_factory_make("queue", queue_name), adopt_mode::ref_sink);
+  branch->volume = auto_gobject_ptr<GstElement>(
+      gst_element_factory_make("volume", volume_name), adopt_mode::ref_sink);
+  g_free(src_name);
+  g_free(queue_name);
+  g_free(volume_name);
+
+  if (!branch->appsrc || !branch->queue || !branch->volume) {
+    g_error("Gst element could not be created\n");
+  }
+
+  // the volume follows a control source, so that it can ramp within a buffer
+  branch->volume_control = auto_gobject_ptr<GstControlSource>(
+      gst_interpolation_control_source_new(), adopt_mode::owned);
+  g_object_set(G_OBJECT(branch->volume_control.get()), "mode",
+               GST_INTERPOLATION_MODE_LINEAR, NULL);
+  gst_timed_value_control_source_set(
+      GST_TIMED_VALUE_CONTROL_SOURCE(branch->volume_control.get()), 0,
+      branch->target_volume);
+  gst_object_add_control_binding(
+      GST_OBJECT(branch->volume.get()),
+      gst_direct_control_binding_new_absolute(
+          GST_OBJECT(branch->volume.get()), "volume",
+          branch->volume_control.get()));
+
+  GstCaps *caps = make_caps();
+  g_object_set(G_OBJECT(branch->appsrc.get()), "caps", caps, "format",
+               GST_FORMAT_TIME, "is-live", true, NULL);
+  gst_caps_unref(caps);
+
+  gst_bin_add_many(GST_BIN(pipeline.get()), branch->appsrc.get(),
+                   branch->queue.get(), branch->volume.get(), NULL);
+  gst_element_link_many(branch->appsrc.get(), branch->queue.get(),
+                        branch->volume.get(), mixer.get(), NULL);
+  // the output might be running already
+  gst_element_sync_state_with_parent(branch->volume.get());
+  gst_element_sync_state_with_parent(branch->queue.get());
+  gst_element_sync_state_with_parent(branch->appsrc.get());
+
+  g_debug("Added %s branch to output %s", dest_name, name.c_str());
+  GstElement *queue = branch->queue.get();
+  branches[destination] = std::move(branch);
+  return queue;
+}
+
+genie::AudioOutput::Branch *
+genie::AudioOutput::get_branch(AudioDestination destination) {
+  auto it = branches.find(destination);
+  if (it == branches.end()) {
+    add_branch(destination);
+    it = branches.find(destination);
+  }
+  return it->second.get();
+}
+
+GstClockTime genie::AudioOutput::running_time() {
+  GstClock *clock = gst_element_get_clock(pipeline.get());
+  if (!clock)
+    return 0;
+
+  GstClockTime now = gst_clock_get_time(clock);
+  gst_object_unref(clock);
+  GstClockTime base_time = gst_element_get_base_time(pipeline.get());
+  return now > base_time ? now - base_time : 0;
+}
+
+void genie::AudioOutput::push(AudioDestination destination,
+                              GstBuffer *buffer) {
+  get_branch(destination)->push(buffer);
+}
+
+void genie::AudioOutput::Branch::push(GstBuffer *buffer) {
+  buffer = gst_buffer_make_writable(buffer);
+  GstClockTime duration = gst_util_uint64_scale(
+      gst_buffer_get_size(buffer) / FRAME_SIZE, GST_SECOND, RATE);
+  GstClockTime now = output->running_time();
+
+  {
+    std::lock_guard<std::mutex> lock(output->timestamp_mutex);
+    // keep contiguous audio contiguous, and play immediately after a gap
+    if (next_timestamp < now)
+      next_timestamp = now;
+    GST_BUFFER_PTS(buffer) = next_timestamp;
+    GST_BUFFER_DURATION(buffer) = duration;
+    next_timestamp += duration;
+  }
+
+  GstFlowReturn ret;
+  g_signal_emit_by_name(appsrc.get(), "push-buffer", buffer, &ret);
+  gst_buffer_unref(buffer);
+}
+
+void genie::AudioOutput::flush(AudioDestination destination) {
+  auto it = branches.find(destination);
+  if (it == branches.end())
+    return;
+  Branch *branch = it->second.get();
+
+  // drop what is still queued in the branch, but keep the live pipeline and
+  // the other branches running
+  gst_element_send_event(branch->appsrc.get(), gst_event_new_flush_start());
+  gst_element_send_event(branch->appsrc.get(),
+                         gst_event_new_flush_stop(false));
+
+  std::lock_guard<std::mutex> lock(timestamp_mutex);
+  branch->next_timestamp = 0;
+}
+
+GstClockTime genie::AudioOutput::queued(AudioDestination destination) {
+  auto it = branches.find(destination);
+  if (it == branches.end() || !running)
+    return 0;
+
+  GstClockTime now = running_time();
+  std::lock_guard<std::mutex> lock(timestamp_mutex);
+  GstClockTime next_timestamp = it->second->next_timestamp;
+  return next_timestamp > now ? next_timestamp - now : 0;
+}
+
+void genie::AudioOutput::ramp_volume(AudioDestination destination,
+                                     double volume, GstClockTime duration) {
+  Branch *branch = get_branch(destination);
+  auto control = GST_TIMED_VALUE_CONTROL_SOURCE(branch->volume_control.get());
+
+  // the buffers are timestamped in running time, from the point they reach
+  // the mixer, so the ramp starts with the next audio pushed
+  GstClockTime now = running ? running_time() : 0;
+  gdouble current = branch->target_volume;
+  gst_control_source_get_value(branch->volume_control.get(), now, &current);
+
+  gst_timed_value_control_source_unset_all(control);
+  gst_timed_value_control_source_set(control, now, current);
+  gst_timed_value_control_source_set(control, now + duration, volume);
+  branch->target_volume = volume;
+}
+
+GstClockTime genie::AudioOutput::latency() {
+  GstClockTime latency = 0;
+  GstQuery *query = gst_query_new_latency();
+  if (gst_element_query(pipeline.get(), query))
+    gst_query_parse_latency(query, nullptr, &latency, nullptr);
+  gst_query_unref(query);
+  return latency;
+}
+
+GstElement *genie::AudioOutput::make_task_sink(AudioDestination destination,
+                                               const char *name) {
+  GstElement *bin = gst_bin_new(name);
+  auto convert = gst_element_factory_make("audioconvert", nullptr);
+  auto resample = gst_element_factory_make("audioresample", nullptr);
+  auto appsink = gst_element_factory_make("appsink", nullptr);
+
+  if (!convert || !resample || !appsink) {
+    g_error("Gst element could not be created\n");
+  }
+
+  // sync makes the task pipeline run in real time, so it does not flood the
+  // output with a whole song at once
+  GstCaps *caps = make_caps();
+  g_object_set(G_OBJECT(appsink), "caps", caps, "sync", true, "emit-signals",
+               true, NULL);
+  gst_caps_unref(caps);
+  g_signal_connect(appsink, "new-sample", G_CALLBACK(on_new_sample),
+                   get_branch(destination));
+
+  gst_bin_add_many(GST_BIN(bin), convert, resample, appsink, NULL);
+  gst_element_link_many(convert, resample, appsink, NULL);
+
+  GstPad *pad = gst_element_get_static_pad(convert, "sink");
+  gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+  gst_object_unref(pad);
+
+  return bin;
+}
+
+GstFlowReturn genie::AudioOutput::on_new_sample(GstElement *appsink,
+                                                gpointer data) {
+  Branch *branch = static_cast<Branch *>(data);
+
+  GstSample *sample;
+  g_signal_emit_by_name(appsink, "pull-sample", &sample);
+  if (!sample)
+    return GST_FLOW_EOS;
+
+  branch->push(gst_buffer_ref(gst_sample_get_buffer(sample)));
+  gst_sample_unref(sample);
+  return GST_FLOW_OK;
+}
+
+gboolean genie::AudioOutput::bus_call(GstBus *bus, GstMessage *msg,
+                                      gpointer data) {
+  AudioOutput *self = static_cast<AudioOutput *>(data);
+
+  if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+    gchar *debug;
+    GError *error = NULL;
+    gst_message_parse_error(msg, &error, &debug);
+    g_free(debug);
+
+    g_warning("Error on output %s: %s", self->name.c_str(), error->message);
+    g_error_free(error);
+
+    // bring the output down, it is restarted when next acquired
+    self->stop();
+  }
+
+  return true;
+}
@@ -0,0 +1,159 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "app.hpp"
+#include "utils/autoptrs.hpp"
+
+#include <gst/controller/gstinterpolationcontrolsource.h>
+#include <gst/gst.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace genie {
+
+enum class AudioDestination { VOICE, MUSIC, ALERT };
+
+/**
+ * @brief A persistent output stream to one audio device.
+ *
+ * The output is a live pipeline with an audiomixer in front of the sink, and
+ * one branch (appsrc ! queue ! volume) per destination playing to the
+ * device, so voice and alerts can play over music without stopping it. While
+ * the output is in use the pipeline stays in the PLAYING state across tasks,
+ * so the device is not opened and configured again before every sound or
+ * utterance. Once the output has not been used for `idle_timeout_ms`, the
+ * pipeline is shut down and the device is released. It is brought back up
+ * by the next `acquire`.
+ *
+ * Audio is pushed into a branch either directly (`push`), or by task
+ * pipelines ending in a sink made with `make_task_sink`.
+ */
+class AudioOutput {
+public:
+  // format of the audio pushed into the output
+  static const int RATE = 48000;
+  static const int CHANNELS = 2;
+  static const size_t FRAME_SIZE = CHANNELS * sizeof(int16_t);
+
+  AudioOutput(App *app, const char *name, const char *device,
+              size_t idle_timeout_ms);
+  ~AudioOutput();
+
+  static GstCaps *make_caps();
+
+  /**
+   * @brief Mark the output as in use, starting it if needed. Must be
+   * balanced by a call to `release`.
+   */
+  void acquire();
+  void release();
+
+  bool has_branch(AudioDestination destination) const;
+
+  /**
+   * @brief Add the branch mixing `destination` into the output.
+   *
+   * @return The queue at the head of the branch.
+   */
+  GstElement *add_branch(AudioDestination destination);
+
+  /**
+   * @brief Create a sink for a task pipeline, which converts the audio to
+   * the output format and forwards it to the branch of `destination`, in
+   * real time.
+   *
+   * @return A floating reference to the new element.
+   */
+  GstElement *make_task_sink(AudioDestination destination, const char *name);
+
+  /**
+   * @brief Queue `buffer` (transfer full) on the branch of `destination`,
+   * right after the audio pushed there so far, or immediately if the branch
+   * has run dry. Thread-safe.
+   */
+  void push(AudioDestination destination, GstBuffer *buffer);
+
+  /**
+   * @brief Drop the audio queued on the branch of `destination`.
+   */
+  void flush(AudioDestination destination);
+
+  /**
+   * @brief Get the duration of the audio pushed on the branch of
+   * `destination` that has not reached the mixer yet. Once it has, it still
+   * takes `latency()` to come out of the device.
+   */
+  GstClockTime queued(AudioDestination destination);
+
+  /**
+   * @brief Ramp the volume of the branch of `destination` linearly from its
+   * current level to `volume`, over `duration`.
+   *
+   * The ramp is applied by the volume element of the branch, sample by
+   * sample, from the audio that reaches the mixer next.
+   */
+  void ramp_volume(AudioDestination destination, double volume,
+                   GstClockTime duration);
+
+  GstClockTime latency();
+
+private:
+  struct Branch {
+    AudioOutput *const output;
+    auto_gobject_ptr<GstElement> appsrc;
+    auto_gobject_ptr<GstElement> queue;
+    auto_gobject_ptr<GstElement> volume;
+    auto_gobject_ptr<GstControlSource> volume_control;
+    // level the volume settles at once the current ramp is over
+    double target_volume = 1.0;
+    // protected by the timestamp mutex of the output
+    GstClockTime next_timestamp = 0;
+
+    Branch(AudioOutput *output) : output(output) {}
+    void push(GstBuffer *buffer);
+  };
+
+  App *const app;
+  const std::string name;
+  const size_t idle_timeout_ms;
+
+  auto_gobject_ptr<GstElement> pipeline;
+  auto_gobject_ptr<GstElement> mixer;
+  std::map<AudioDestination, std::unique_ptr<Branch>> branches;
+  guint bus_watch_id;
+  guint idle_timeout_id;
+  int users;
+  bool running;
+
+  std::mutex timestamp_mutex;
+
+  void start();
+  void stop();
+  void reset_timestamps();
+  GstClockTime running_time();
+  Branch *get_branch(AudioDestination destination);
+
+  static gboolean bus_call(GstBus *bus, GstMessage *msg, gpointer data);
+  static GstFlowReturn on_new_sample(GstElement *appsink, gpointer data);
+};
+
+} // namespace genie
@@ -17,6 +17,9 @@
 // limitations under the License.
 
 #include "audioplayer.hpp"
+#include "metrics.hpp"
+#include "stats.hpp"
+#include "utils/soup-utils.hpp"
 
 #include <glib.h>
 #include <gst/gst.h>
@@ -41,26 +44,532 @@ static const gchar *get_audio_output(const genie::Config &config,
   }
 }
 
+genie::URLAudioTask::~URLAudioTask() {
+  if (about_to_finish_id)
+    g_signal_handler_disconnect(pipeline.get(), about_to_finish_id);
+  // let go of the stream if the task was dropped before it started, or
+  // while it was preempted
+  if ((prerolled || preempted) && !suspended)
+    gst_element_set_state(pipeline.get(), idle_state());
+}
+
 void genie::URLAudioTask::start() {
+  if (!prerolled)
+    g_object_set(G_OBJECT(pipeline.get()), "uri", urls[0].c_str(), nullptr);
+  next_url = 1;
+  if (urls.size() > 1) {
+    about_to_finish_id =
+        g_signal_connect(pipeline.get(), "about-to-finish",
+                         G_CALLBACK(on_about_to_finish), this);
+  }
+
+  is_live = gst_element_set_state(pipeline.get(), GST_STATE_PLAYING) ==
+            GST_STATE_CHANGE_NO_PREROLL;
+}
+
+void genie::URLAudioTask::stop() {
+  // returns once the streaming threads are stopped, so about-to-finish is
+  // not running anymore
+  gst_element_set_state(pipeline.get(), idle_state());
+  if (about_to_finish_id) {
+    g_signal_handler_disconnect(pipeline.get(), about_to_finish_id);
+    about_to_finish_id = 0;
+  }
+  buffering = false;
+  paused = false;
+  suspended = false;
+  seeking = false;
+}
+
+void genie::URLAudioTask::pause() {
+  paused = true;
+  gst_element_set_state(pipeline.get(), GST_STATE_PAUSED);
+}
+
+void genie::URLAudioTask::resume() {
+  paused = false;
+  if (suspended) {
+    suspended = false;
+    g_object_set(G_OBJECT(pipeline.get()), "uri", resume_uri.c_str(),
+                 nullptr);
+    if (resume_position > 0) {
+      // seek once prerolled, see on_async_done()
+      seeking = true;
+      gst_element_set_state(pipeline.get(), GST_STATE_PAUSED);
+      return;
+    }
+    // a live stream starts over
+    is_live = gst_element_set_state(pipeline.get(), GST_STATE_PLAYING) ==
+              GST_STATE_CHANGE_NO_PREROLL;
+    return;
+  }
+  // otherwise playback resumes once the buffer is full again
+  if (!buffering)
+    gst_element_set_state(pipeline.get(), GST_STATE_PLAYING);
+}
+
+/**
+ * @brief Take the pipeline down to NULL, which closes the sink and the
+ * stream, remembering the URL and the position to resume from.
+ */
+void genie::URLAudioTask::suspend() {
+  if (suspended)
+    return;
+
+  gint64 position = 0;
+  if (is_live || !gst_element_query_position(pipeline.get(), GST_FORMAT_TIME,
+                                             &position))
+    position = 0;
+  resume_position = position;
+
+  gchar *current_uri = nullptr;
+  gchar *next_uri = nullptr;
+  g_object_get(G_OBJECT(pipeline.get()), "current-uri", &current_uri, "uri",
+               &next_uri, nullptr);
+  resume_uri = current_uri ? current_uri : urls[0];
+  // about-to-finish already handed over the next URL, hand it over again
+  // when the resumed one finishes
+  if (g_strcmp0(current_uri, next_uri) != 0 && next_url > 1)
+    next_url--;
+  g_free(current_uri);
+  g_free(next_uri);
+
+  paused = true;
+  suspended = true;
+  seeking = false;
+  buffering = false;
+  gst_element_set_state(pipeline.get(), GST_STATE_NULL);
+}
+
+void genie::URLAudioTask::on_async_done() {
+  if (!seeking)
+    return;
+  seeking = false;
+
+  g_debug("Resuming at %" GST_TIME_FORMAT, GST_TIME_ARGS(resume_position));
+  gst_element_seek_simple(
+      pipeline.get(), GST_FORMAT_TIME,
+      (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT),
+      resume_position);
+  if (!paused && !buffering)
+    gst_element_set_state(pipeline.get(), GST_STATE_PLAYING);
+}
+
+/**
+ * @brief Pause while the network buffers are refilling, so the stream does
+ * not stutter. Live streams cannot be paused, and play through.
+ */
+void genie::URLAudioTask::on_buffering(int percent) {
+  if (is_live)
+    return;
+
+  // a resumed task waits for its seek before it plays, see on_async_done()
+  if (percent < 100 && !buffering) {
+    g_debug("Buffering (%d%%), pausing", percent);
+    buffering = true;
+    if (!paused && !seeking)
+      gst_element_set_state(pipeline.get(), GST_STATE_PAUSED);
+  } else if (percent >= 100 && buffering) {
+    g_debug("Buffering done, resuming");
+    buffering = false;
+    if (!paused && !seeking)
+      gst_element_set_state(pipeline.get(), GST_STATE_PLAYING);
+  }
+}
+
+/**
+ * @brief Skip to the next URL when the current one fails, and only give up
+ * on the task when there is none left.
+ */
+bool genie::URLAudioTask::on_error() {
+  if (next_url >= urls.size())
+    return false;
+
+  const std::string &url = urls[next_url++];
+  g_message("Skipping to %s after the error", url.c_str());
+  gst_element_set_state(pipeline.get(), GST_STATE_READY);
+  // the failed stream can post more than one error, drop the rest
+  GstBus *bus = gst_element_get_bus(pipeline.get());
+  gst_bus_set_flushing(bus, true);
+  gst_bus_set_flushing(bus, false);
+  gst_object_unref(bus);
+
   g_object_set(G_OBJECT(pipeline.get()), "uri", url.c_str(), nullptr);
+  buffering = false;
+  if (paused) {
+    gst_element_set_state(pipeline.get(), GST_STATE_PAUSED);
+  } else {
+    is_live = gst_element_set_state(pipeline.get(), GST_STATE_PLAYING) ==
+              GST_STATE_CHANGE_NO_PREROLL;
+  }
+  return true;
+}
 
-  // PROF_PRINT("gst pipeline started\n");
-  gettimeofday(&t_start, NULL);
-  gst_element_set_state(pipeline.get(), GST_STATE_PLAYING);
+void genie::URLAudioTask::on_about_to_finish(GstElement *playbin,
+                                             gpointer data) {
+  URLAudioTask *self = static_cast<URLAudioTask *>(data);
+  if (self->next_url >= self->urls.size())
+    return;
+
+  const std::string &url = self->urls[self->next_url++];
+  g_message("Queueing %s after the current stream", url.c_str());
+  g_object_set(G_OBJECT(playbin), "uri", url.c_str(), nullptr);
+}
+
+bool genie::AudioTask::owns_message(GstMessage *msg) const {
+  if (!pipeline)
+    return false;
+
+  GstObject *src = GST_MESSAGE_SRC(msg);
+  GstObject *pipeline_object = GST_OBJECT(pipeline.get());
+  return src == pipeline_object ||
+         gst_object_has_as_ancestor(src, pipeline_object);
+}
+
+genie::SoundAudioTask::~SoundAudioTask() {
+  if (done_timeout_id)
+    g_source_remove(done_timeout_id);
+  g_bytes_unref(pcm);
+}
+
+void genie::SoundAudioTask::start() {
+  if (!output) {
+    gst_element_set_state(pipeline.get(), GST_STATE_PLAYING);
+
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline.get()), "src");
+    GstBuffer *buffer = gst_buffer_new_wrapped_bytes(pcm);
+    GstFlowReturn ret;
+    g_signal_emit_by_name(src, "push-buffer", buffer, &ret);
+    gst_buffer_unref(buffer);
+    g_signal_emit_by_name(src, "end-of-stream", &ret);
+    gst_object_unref(src);
+    return;
+  }
+
+  output->push(destination, gst_buffer_new_wrapped_bytes(pcm));
+
+  // done once the sound has reached the mixer, like a task pipeline
+  // reaching its end-of-stream
+  done_timeout_id = g_timeout_add(
+      GST_TIME_AS_MSECONDS(output->queued(destination)),
+      [](gpointer data) {
+        SoundAudioTask *self = static_cast<SoundAudioTask *>(data);
+        self->done_timeout_id = 0;
+        // destroys the task
+        self->player->on_task_done(self);
+        return G_SOURCE_REMOVE;
+      },
+      this);
+}
+
+void genie::SoundAudioTask::stop() {
+  if (!output) {
+    AudioTask::stop();
+    return;
+  }
+  if (done_timeout_id) {
+    g_source_remove(done_timeout_id);
+    done_timeout_id = 0;
+  }
+}
+
+genie::SayAudioTask::~SayAudioTask() {
+  if (self_ref)
+    *self_ref = nullptr;
+  cancel_fetch();
+  if (response)
+    g_bytes_unref(response);
 }
 
 void genie::SayAudioTask::start() {
-  if (soup_has_post_data)
-    say_post();
-  else
-    say_get();
+  if (cache) {
+    GBytes *audio = cache->lookup(cache_key);
+    if (audio) {
+      g_message("Playing TTS response from cache");
+      // entries can be in any of the formats the service replies with, so
+      // let decodebin find out
+      play_buffered(audio, nullptr);
+      g_bytes_unref(audio);
+      return;
+    }
+  }
+
+  switch (fetch_state) {
+    case FetchState::DONE:
+      g_message("Playing prefetched TTS response");
+      play_buffered(response, content_type.c_str());
+      break;
+
+    case FetchState::FETCHING:
+      // the response is on its way, play what arrived so far and follow
+      start_streaming();
+      break;
+
+    case FetchState::NONE:
+    case FetchState::FAILED:
+      fetch();
+      start_streaming();
+      break;
+  }
+}
+
+void genie::SayAudioTask::stop() {
+  cancel_fetch();
+  AudioTask::stop();
+}
+
+void genie::SayAudioTask::complete() {
+  if (cache && response)
+    cache->store(cache_key, response);
+}
+
+/**
+ * @brief Play the response while it downloads.
+ *
+ * The decode chain depends on the content type, so the pipeline only starts
+ * once the headers of the response arrived.
+ */
+void genie::SayAudioTask::start_streaming() {
+  streaming = true;
+  if (got_headers)
+    start_pushing();
+}
+
+/**
+ * @brief Start the pipeline of a streaming task, beginning with the part of
+ * the body received so far.
+ */
+void genie::SayAudioTask::start_pushing() {
+  set_content_type(content_type.c_str());
+  // appsrc only accepts buffers once it has started
+  gst_element_set_state(pipeline.get(), GST_STATE_PLAYING);
+  pushing = true;
+
+  SoupBuffer *received = soup_message_body_flatten(message->response_body);
+  if (received->length > 0) {
+    GBytes *bytes = soup_buffer_get_as_bytes(received);
+    push_bytes(bytes);
+    g_bytes_unref(bytes);
+  }
+  soup_buffer_free(received);
+}
+
+/**
+ * @brief Play a complete TTS response from memory.
+ *
+ * The bytes are handed to appsrc as a single buffer, without copying.
+ */
+void genie::SayAudioTask::play_buffered(GBytes *audio,
+                                        const char *content_type) {
+  set_content_type(content_type);
+  gst_element_set_state(pipeline.get(), GST_STATE_PAUSED);
+
+  push_bytes(audio);
+  GstFlowReturn ret;
+  g_signal_emit_by_name(saysrc.get(), "end-of-stream", &ret);
 
-  // PROF_PRINT("gst pipeline started\n");
-  gettimeofday(&t_start, NULL);
   gst_element_set_state(pipeline.get(), GST_STATE_PLAYING);
 }
 
-void genie::SayAudioTask::say_post() {
+/**
+ * @brief Set the caps of appsrc for a response of type `content_type`, so
+ * that decodebin plugs the matching decoder. Unknown types, or nullptr,
+ * leave it to typefinding.
+ */
+void genie::SayAudioTask::set_content_type(const char *content_type) {
+  GstCaps *caps = nullptr;
+  if (!content_type) {
+    // typefind
+  } else if (!g_ascii_strcasecmp(content_type, "audio/ogg") ||
+             !g_ascii_strcasecmp(content_type, "audio/opus")) {
+    caps = gst_caps_new_empty_simple("audio/ogg");
+  } else if (!g_ascii_strcasecmp(content_type, "audio/mpeg") ||
+             !g_ascii_strcasecmp(content_type, "audio/mp3")) {
+    caps = gst_caps_new_simple("audio/mpeg", "mpegversion", G_TYPE_INT, 1,
+                               nullptr);
+  } else if (!g_ascii_strcasecmp(content_type, "audio/wav") ||
+             !g_ascii_strcasecmp(content_type, "audio/x-wav") ||
+             !g_ascii_strcasecmp(content_type, "audio/wave")) {
+    caps = gst_caps_new_empty_simple("audio/x-wav");
+  } else if (*content_type) {
+    g_warning("Unexpected TTS content type %s", content_type);
+  }
+
+  g_object_set(G_OBJECT(saysrc.get()), "caps", caps, nullptr);
+  if (caps)
+    gst_caps_unref(caps);
+}
+
+void genie::SayAudioTask::push_bytes(GBytes *bytes) {
+  GstFlowReturn ret;
+  GstBuffer *buffer = gst_buffer_new_wrapped_bytes(bytes);
+  g_signal_emit_by_name(saysrc.get(), "push-buffer", buffer, &ret);
+  gst_buffer_unref(buffer);
+}
+
+bool genie::SayAudioTask::needs_prefetch() const {
+  if (fetch_state != FetchState::NONE)
+    return false;
+  return !cache || !cache->contains(cache_key);
+}
+
+void genie::SayAudioTask::prefetch() {
+  g_debug("Prefetching TTS for \"%s\"", text.c_str());
+  fetch();
+}
+
+/**
+ * @brief POST the TTS request through the shared session.
+ *
+ * The body accumulates in the message, so that it can be cached once the
+ * download completes, and is forwarded chunk by chunk while streaming.
+ */
+void genie::SayAudioTask::fetch() {
+  SoupMessage *msg = soup_message_new(SOUP_METHOD_POST, base_tts_url.c_str());
+  std::string body = request_body();
+  g_debug("TTS body: %s", body.c_str());
+  soup_message_set_request(msg, "application/json", SOUP_MEMORY_COPY,
+                           body.c_str(), body.size());
+  // the decode chain follows the content type of the response, so WAV still
+  // plays if the service ignores the preference
+  soup_message_headers_replace(
+      msg->request_headers, "Accept",
+      compressed ? "audio/ogg; codecs=opus, audio/mpeg; q=0.9, audio/wav; "
+                   "q=0.5"
+                 : "audio/wav");
+
+  got_headers_id =
+      g_signal_connect(msg, "got-headers", G_CALLBACK(on_got_headers), this);
+  got_chunk_id =
+      g_signal_connect(msg, "got-chunk", G_CALLBACK(on_got_chunk), this);
+  network_event_id = g_signal_connect(msg, "network-event",
+                                      G_CALLBACK(on_network_event), this);
+
+  fetch_state = FetchState::FETCHING;
+  message = msg;
+  t_fetch_start = tracer->now();
+  new_connection = false;
+  got_headers = false;
+  if (!self_ref)
+    self_ref = std::make_shared<SayAudioTask *>(this);
+
+  std::shared_ptr<SayAudioTask *> ref = self_ref;
+  send_soup_message(session, msg,
+                    [ref](SoupSession *session, SoupMessage *msg) {
+                      // the task was dropped from the queue
+                      if (!*ref)
+                        return;
+                      (*ref)->on_fetch_done(msg);
+                    });
+}
+
+void genie::SayAudioTask::cancel_fetch() {
+  if (fetch_state != FetchState::FETCHING)
+    return;
+
+  SoupMessage *msg = message;
+  release_message();
+  fetch_state = FetchState::FAILED;
+  soup_session_cancel_message(session, msg, SOUP_STATUS_CANCELLED);
+}
+
+void genie::SayAudioTask::release_message() {
+  g_signal_handler_disconnect(message, got_headers_id);
+  g_signal_handler_disconnect(message, got_chunk_id);
+  g_signal_handler_disconnect(message, network_event_id);
+  message = nullptr;
+}
+
+void genie::SayAudioTask::on_got_headers(SoupMessage *msg, gpointer data) {
+  SayAudioTask *self = static_cast<SayAudioTask *>(data);
+  guint status_code;
+  g_object_get(msg, "status-code", &status_code, nullptr);
+  // errors are reported once the request completes
+  if (!SOUP_STATUS_IS_SUCCESSFUL(status_code))
+    return;
+
+  const char *content_type =
+      soup_message_headers_get_content_type(msg->response_headers, nullptr);
+  self->content_type = content_type ? content_type : "";
+  self->got_headers = true;
+  self->tracer->span("tts.headers", self->t_fetch_start);
+  g_debug("TTS response is %s",
+          content_type ? content_type : "of unknown type");
+
+  if (self->streaming)
+    self->start_pushing();
+}
+
+void genie::SayAudioTask::on_got_chunk(SoupMessage *msg, SoupBuffer *chunk,
+                                       gpointer data) {
+  SayAudioTask *self = static_cast<SayAudioTask *>(data);
+  if (!self->pushing)
+    return;
+
+  GBytes *bytes = soup_buffer_get_as_bytes(chunk);
+  self->push_bytes(bytes);
+  g_bytes_unref(bytes);
+}
+
+void genie::SayAudioTask::on_network_event(SoupMessage *msg,
+                                           GSocketClientEvent event,
+                                           GIOStream *connection,
+                                           gpointer data) {
+  SayAudioTask *self = static_cast<SayAudioTask *>(data);
+  // only emitted when the session opens a new connection for the request
+  if (event == G_SOCKET_CLIENT_CONNECTING)
+    self->new_connection = true;
+}
+
+void genie::SayAudioTask::on_fetch_done(SoupMessage *msg) {
+  // the request was cancelled
+  if (msg != message)
+    return;
+
+  release_message();
+  tracer->span("tts.fetch", t_fetch_start);
+
+  guint status_code;
+  g_object_get(msg, "status-code", &status_code, nullptr);
+  if (!SOUP_STATUS_IS_TRANSPORT_ERROR(status_code)) {
+    stats->record("tts.connection_reused", new_connection ? 0 : 1);
+    g_debug("TTS request on %s connection, reuse rate %.0f%%",
+            new_connection ? "a new" : "a kept-alive",
+            stats->mean("tts.connection_reused") * 100);
+  }
+
+  if (!SOUP_STATUS_IS_SUCCESSFUL(status_code)) {
+    g_warning("Failed to fetch TTS response: HTTP %u", status_code);
+    fetch_state = FetchState::FAILED;
+    if (streaming)
+      post_error(status_code);
+    return;
+  }
+
+  g_object_get(msg, "response-body-data", &response, nullptr);
+  fetch_state = FetchState::DONE;
+  g_debug("Fetched TTS response (%zu bytes)", g_bytes_get_size(response));
+
+  if (streaming) {
+    GstFlowReturn ret;
+    g_signal_emit_by_name(saysrc.get(), "end-of-stream", &ret);
+  }
+}
+
+/**
+ * @brief Report a failed request of a streaming task through the bus, like a
+ * failing element would, so that the player moves on to the next task.
+ */
+void genie::SayAudioTask::post_error(guint status_code) {
+  GError *error = g_error_new(GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_READ,
+                              "TTS request failed: HTTP %u", status_code);
+  gst_element_post_message(
+      saysrc.get(),
+      gst_message_new_error(GST_OBJECT(saysrc.get()), error, nullptr));
+  g_error_free(error);
+}
+
+std::string genie::SayAudioTask::request_body() {
   auto_gobject_ptr<JsonBuilder> builder(json_builder_new(), adopt_mode::owned);
   json_builder_begin_object(builder.get());
 
@@ -75,105 +584,413 @@ void genie::SayAudioTask::say_post() {
   auto_gobject_ptr<JsonGenerator> gen(json_generator_new(), adopt_mode::owned);
   JsonNode *root = json_builder_get_root(builder.get());
   json_generator_set_root(gen.get(), root);
+  json_node_unref(root);
   gchar *jsonText = json_generator_to_data(gen.get(), NULL);
-
-  g_debug("TTS body: %s", jsonText);
-  g_object_set(G_OBJECT(soupsrc.get()), "post-data", jsonText, NULL);
-
+  std::string body(jsonText);
   g_free(jsonText);
-}
 
-void genie::SayAudioTask::say_get() {
-  std::unique_ptr<SoupURI, fn_deleter<SoupURI, soup_uri_free>> uri(
-      soup_uri_new(base_tts_url.c_str()));
-  soup_uri_set_query_from_fields(uri.get(), "text", text.c_str(), "gender",
-                                 voice, nullptr);
-
-  gchar *uristr = soup_uri_to_string(uri.get(), false);
-  g_object_set(G_OBJECT(soupsrc.get()), "location", uristr, nullptr);
-  g_free(uristr);
+  return body;
 }
 
-genie::AudioPlayer::AudioPlayer(App *appInstance)
-    : app(appInstance), playing(false) {
+void genie::AudioPlayer::init_gstreamer() {
   gst_init(NULL, NULL);
 #ifdef STATIC
   gst_init_static_plugins();
 #endif
+}
 
+genie::AudioPlayer::AudioPlayer(App *appInstance)
+    : app(appInstance) {
   gchar *location = g_strdup_printf("%s/%s/voice/tts", app->config->nl_url,
                                     app->config->locale);
   base_tts_url = location;
   g_free(location);
 
+  if (app->config->tts_cache) {
+    gchar *tts_cache_dir =
+        g_build_filename(app->config->cache_dir, "tts", nullptr);
+    tts_cache = std::make_unique<TTSCache>(
+        tts_cache_dir, app->config->tts_cache_size_mb * 1024 * 1024);
+    g_free(tts_cache_dir);
+  }
+
   init_say_pipeline();
-  init_url_pipeline();
+  init_url_pipeline(url_pipeline, AudioDestination::MUSIC, "audio-player-url");
+  init_url_pipeline(alert_url_pipeline, AudioDestination::ALERT,
+                    "audio-player-alert-url");
+  // only in hot sink mode: a prerolled sink holds the device open, which
+  // would get in the way of the music playing
+  if (app->config->audio_hot_sink)
+    init_url_pipeline(standby_url_pipeline, AudioDestination::MUSIC,
+                      "audio-player-standby-url");
+
+  if (app->config->sound_preload)
+    preload_sounds();
 }
 
-static bool has_property(genie::auto_gobject_ptr<GObject> obj,
-                         const char *property) {
-  GObjectClass *class_ = G_OBJECT_CLASS(g_type_class_ref(obj.type()));
-  bool has_prop = g_object_class_find_property(class_, property);
-  g_type_class_unref(class_);
+genie::AudioPlayer::~AudioPlayer() {
+  if (preload_thread.joinable()) {
+    // waits for the sound being decoded, if any
+    preload_cancelled.store(true);
+    preload_thread.join();
+  }
+  if (preload_idle_id)
+    g_source_remove(preload_idle_id);
+  for (auto &it : preloaded)
+    g_bytes_unref(it.second);
+
+  for (Lane *lane : {&foreground, &music}) {
+    if (lane->end_timeout_id)
+      g_source_remove(lane->end_timeout_id);
+  }
+  if (standby_timeout_id)
+    g_source_remove(standby_timeout_id);
+  if (pause_timeout_id)
+    g_source_remove(pause_timeout_id);
+}
 
-  return has_prop;
+GstPadProbeReturn genie::AudioPlayer::on_sink_buffer(GstPad *pad,
+                                                     GstPadProbeInfo *info,
+                                                     gpointer data) {
+  Lane *lane = static_cast<Lane *>(data);
+  gint64 unset = 0;
+  if (lane->t_first_buffer.compare_exchange_strong(unset,
+                                                   g_get_monotonic_time()))
+    g_idle_add(on_first_buffer, lane);
+  return GST_PAD_PROBE_OK;
 }
 
+gboolean genie::AudioPlayer::on_first_buffer(gpointer data) {
+  Lane *lane = static_cast<Lane *>(data);
+  lane->player->on_task_audible(*lane);
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Note when the first buffer after the start of a task of `lane`
+ * reaches `element`, which hands it to the device, to find out when the
+ * task becomes audible.
+ */
+void genie::AudioPlayer::watch_first_buffer(GstElement *element, Lane &lane) {
+  GstPad *pad = gst_element_get_static_pad(element, "sink");
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_sink_buffer, &lane,
+                    nullptr);
+  gst_object_unref(pad);
+}
+
+/**
+ * @brief Get the time a buffer takes from the first buffer probe of `task`
+ * to the device, as reported by the pipeline holding the sink.
+ */
+GstClockTime genie::AudioPlayer::sink_latency(AudioTask *task) {
+  if (task->output)
+    return task->output->latency();
+
+  GstClockTime latency = 0;
+  GstQuery *query = gst_query_new_latency();
+  if (gst_element_query(task->get_pipeline(), query))
+    gst_query_parse_latency(query, nullptr, &latency, nullptr);
+  gst_query_unref(query);
+  return latency;
+}
+
+genie::AudioPlayer::Lane &
+genie::AudioPlayer::lane_for(AudioDestination destination) {
+  return destination == AudioDestination::MUSIC ? music : foreground;
+}
+
+/**
+ * @brief Get the output for `destination`. Destinations configured with the
+ * same device share one output, and are mixed in it.
+ */
+genie::AudioOutput *
+genie::AudioPlayer::get_output(AudioDestination destination) {
+  const char *device = get_audio_output(*app->config, destination);
+  std::unique_ptr<AudioOutput> &output = outputs[device ? device : ""];
+  if (!output) {
+    output = std::make_unique<AudioOutput>(app, device ? device : "default",
+                                           device,
+                                           app->config->audio_hot_sink_idle_ms);
+  }
+  if (!output->has_branch(destination))
+    watch_first_buffer(output->add_branch(destination), lane_for(destination));
+  return output.get();
+}
+
+/**
+ * @brief Create the sink of a task pipeline playing to `destination`.
+ *
+ * In hot sink mode, this forwards to the persistent output of the
+ * destination, otherwise it is a sink of its own that opens the device
+ * whenever the pipeline starts.
+ */
+GstElement *genie::AudioPlayer::make_sink(AudioDestination destination,
+                                          const char *name) {
+  if (app->config->audio_hot_sink)
+    return get_output(destination)->make_task_sink(destination, name);
+
+  GstElement *sink = gst_element_factory_make(app->config->audio_sink, name);
+  if (!sink)
+    return nullptr;
+
+  const char *output_device = get_audio_output(*app->config, destination);
+  if (output_device) {
+    g_object_set(G_OBJECT(sink), "device", output_device, NULL);
+  }
+  watch_first_buffer(sink, lane_for(destination));
+  return sink;
+}
+
+/**
+ * @brief Get the pipeline playing the preloaded sounds to `destination`,
+ * when the outputs are not kept open, creating it on first use.
+ *
+ * Like the other pipelines of the player, it is kept across tasks, and only
+ * its sink opens the device again for each sound.
+ */
+const auto_gobject_ptr<GstElement> &
+genie::AudioPlayer::get_sound_pipeline(AudioDestination destination) {
+  PipelineState &state = sound_pipelines[destination];
+  if (state.pipeline)
+    return state.pipeline;
+
+  auto pipeline = auto_gobject_ptr<GstElement>(
+      gst_pipeline_new("audio-player-sound"), adopt_mode::ref_sink);
+  auto src = gst_element_factory_make("appsrc", "src");
+  auto convert = gst_element_factory_make("audioconvert", nullptr);
+  auto resample = gst_element_factory_make("audioresample", nullptr);
+  auto sink = make_sink(destination, "audio-output-sound");
+
+  if (!pipeline || !src || !convert || !resample || !sink) {
+    g_error("Gst element could not be created\n");
+  }
+
+  GstCaps *caps = AudioOutput::make_caps();
+  g_object_set(G_OBJECT(src), "caps", caps, "format", GST_FORMAT_TIME, NULL);
+  gst_caps_unref(caps);
+
+  gst_bin_add_many(GST_BIN(pipeline.get()), src, convert, resample, sink,
+                   NULL);
+  gst_element_link_many(src, convert, resample, sink, NULL);
+
+  state.init(this, pipeline);
+  return state.pipeline;
+}
+
+static void on_decoder_pad_added(GstElement *decoder, GstPad *pad,
+                                 gpointer data) {
+  GstElement *convert = static_cast<GstElement *>(data);
+  GstPad *sinkpad = gst_element_get_static_pad(convert, "sink");
+  if (!gst_pad_is_linked(sinkpad))
+    gst_pad_link(pad, sinkpad);
+  gst_object_unref(sinkpad);
+}
+
+/**
+ * @brief Create the pipeline of TTS responses, fed through appsrc.
+ *
+ * decodebin picks the decoder from the caps set on appsrc by each task,
+ * and relinks its output every time the pipeline starts.
+ */
 void genie::AudioPlayer::init_say_pipeline() {
   auto pipeline = auto_gobject_ptr<GstElement>(
       gst_pipeline_new("audio-player-say"), adopt_mode::ref_sink);
-  soupsrc = auto_gobject_ptr<GstElement>(
-      gst_element_factory_make("souphttpsrc", "http-source"),
-      adopt_mode::ref_sink);
-  soup_has_post_data =
-      has_property(soupsrc.cast<GObject>(G_TYPE_OBJECT), "content-type") &&
-      has_property(soupsrc.cast<GObject>(G_TYPE_OBJECT), "post-data");
-
-  auto decoder = gst_element_factory_make("wavparse", "wav-parser");
-  auto sink =
-      gst_element_factory_make(app->config->audio_sink, "audio-output-say");
-
-  if (!pipeline || !soupsrc || !decoder || !sink) {
+  saysrc = auto_gobject_ptr<GstElement>(
+      gst_element_factory_make("appsrc", "say-source"), adopt_mode::ref_sink);
+  auto decoder = gst_element_factory_make("decodebin", "say-decoder");
+  auto convert = gst_element_factory_make("audioconvert", "say-convert");
+  auto resample = gst_element_factory_make("audioresample", "say-resample");
+  auto sink = make_sink(AudioDestination::VOICE, "audio-output-say");
+
+  if (!pipeline || !saysrc || !decoder || !convert || !resample || !sink) {
     g_error("Gst element could not be created\n");
   }
 
-  if (app->config->ssl_ca_file) {
-    g_object_set(G_OBJECT(soupsrc.get()), "ssl-ca-file",
-                 app->config->ssl_ca_file, NULL);
+  g_object_set(G_OBJECT(saysrc.get()), "format", GST_FORMAT_BYTES, NULL);
+  g_signal_connect(decoder, "pad-added", G_CALLBACK(on_decoder_pad_added),
+                   convert);
+
+  gst_bin_add_many(GST_BIN(pipeline.get()), saysrc.get(), decoder, convert,
+                   resample, sink, NULL);
+  gst_element_link(saysrc.get(), decoder);
+  gst_element_link_many(convert, resample, sink, NULL);
+
+  say_pipeline.init(this, pipeline);
+}
+
+/**
+ * @brief Create a playbin pipeline for the URLs played to `destination`.
+ *
+ * There is one per lane, so that an alert can play over the music.
+ */
+void genie::AudioPlayer::init_url_pipeline(PipelineState &state,
+                                           AudioDestination destination,
+                                           const char *name) {
+  gchar *sink_name = g_strdup_printf("%s-sink", name);
+  auto sink = auto_gobject_ptr<GstElement>(make_sink(destination, sink_name),
+                                           adopt_mode::ref_sink);
+  g_free(sink_name);
+
+  auto pipeline = auto_gobject_ptr<GstElement>(
+      gst_element_factory_make("playbin", name), adopt_mode::ref_sink);
+  g_object_set(G_OBJECT(pipeline.get()), "audio-sink", sink.get(),
+               "buffer-duration",
+               (gint64)(app->config->audio_url_buffer_ms * GST_MSECOND),
+               "buffer-size", (gint)(app->config->audio_url_buffer_kb * 1024),
+               nullptr);
+
+  state.init(this, pipeline);
+}
+
+/**
+ * @brief Decode an audio file to PCM in the format of the outputs.
+ *
+ * @return The decoded samples (transfer full), or `nullptr` on error.
+ */
+static GBytes *decode_sound(const gchar *path) {
+  // a sound that does not decode within this time is given up on
+  static const gint64 DECODE_TIMEOUT_US = 5 * G_USEC_PER_SEC;
+  static const GstClockTime PULL_TIMEOUT = 100 * GST_MSECOND;
+
+  GError *error = nullptr;
+  gchar *description = g_strdup_printf(
+      "filesrc name=src ! decodebin ! audioconvert ! audioresample ! "
+      "audio/x-raw,format=S16LE,layout=interleaved,rate=%d,channels=%d ! "
+      "appsink name=sink sync=false",
+      genie::AudioOutput::RATE, genie::AudioOutput::CHANNELS);
+  GstElement *pipeline = gst_parse_launch(description, &error);
+  g_free(description);
+  if (!pipeline) {
+    g_warning("Failed to create decoding pipeline: %s", error->message);
+    g_error_free(error);
+    return nullptr;
   }
+  // a non-fatal error, such as a missing optional element
+  g_clear_error(&error);
+
+  GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+  g_object_set(G_OBJECT(src), "location", path, nullptr);
+  gst_object_unref(src);
+  GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+  GstBus *bus = gst_element_get_bus(pipeline);
 
-  if (soup_has_post_data) {
-    g_object_set(G_OBJECT(soupsrc.get()), "location", base_tts_url.c_str(),
-                 "method", "POST", "content-type", "application/json", NULL);
+  GByteArray *pcm = g_byte_array_new();
+  bool ok = true;
+  if (gst_element_set_state(pipeline, GST_STATE_PLAYING) ==
+      GST_STATE_CHANGE_FAILURE) {
+    g_warning("Failed to decode %s: could not start the pipeline", path);
+    ok = false;
   }
 
-  const char *output_device =
-      get_audio_output(*app->config, AudioDestination::VOICE);
-  if (output_device) {
-    g_object_set(G_OBJECT(sink), "device", output_device, NULL);
+  // the appsink prerolls before the source or the decoder can fail, so a
+  // blocking pull would wait forever on a broken file: poll the bus between
+  // pulls instead
+  gint64 deadline = g_get_monotonic_time() + DECODE_TIMEOUT_US;
+  while (ok) {
+    GstMessage *msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+    if (msg) {
+      gst_message_parse_error(msg, &error, nullptr);
+      g_warning("Failed to decode %s: %s", path, error->message);
+      g_clear_error(&error);
+      gst_message_unref(msg);
+      ok = false;
+      break;
+    }
+
+    GstSample *sample = nullptr;
+    g_signal_emit_by_name(sink, "try-pull-sample", PULL_TIMEOUT, &sample);
+    if (sample) {
+      GstBuffer *buffer = gst_sample_get_buffer(sample);
+      GstMapInfo map;
+      if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        g_byte_array_append(pcm, map.data, map.size);
+        gst_buffer_unmap(buffer, &map);
+      }
+      gst_sample_unref(sample);
+      continue;
+    }
+
+    gboolean eos = false;
+    g_object_get(G_OBJECT(sink), "eos", &eos, nullptr);
+    if (eos)
+      break;
+    if (g_get_monotonic_time() > deadline) {
+      g_warning("Failed to decode %s: timed out", path);
+      ok = false;
+    }
   }
 
-  gst_bin_add_many(GST_BIN(pipeline.get()), soupsrc.get(), decoder, sink, NULL);
-  gst_element_link_many(soupsrc.get(), decoder, sink, NULL);
+  gst_object_unref(bus);
+  gst_object_unref(sink);
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
 
-  say_pipeline.init(this, pipeline);
+  if (!ok) {
+    g_byte_array_unref(pcm);
+    return nullptr;
+  }
+  return g_byte_array_free_to_bytes(pcm);
 }
 
-void genie::AudioPlayer::init_url_pipeline() {
-  auto sink = auto_gobject_ptr<GstElement>(
-      gst_element_factory_make(app->config->audio_sink, "audio-output-url"),
-      adopt_mode::ref_sink);
-  const char *output_device =
-      get_audio_output(*app->config, AudioDestination::MUSIC /* FIXME */);
-  if (output_device)
-    g_object_set(G_OBJECT(sink.get()), "device", output_device, NULL);
+/**
+ * @brief Decode the sounds to PCM on a thread of their own, so the player is
+ * ready without waiting for them. Until a sound is decoded, it plays from its
+ * file, like when preloading is disabled.
+ */
+void genie::AudioPlayer::preload_sounds() {
+  // the wake sound first, it plays at the start of every interaction
+  static const Sound_t all_sounds[] = {
+      Sound_t::WAKE,       Sound_t::NO_INPUT,  Sound_t::NEWS_INTRO,
+      Sound_t::ALARM_CLOCK_ELAPSED, Sound_t::WORKING, Sound_t::STT_ERROR,
+      Sound_t::TOO_MUCH_INPUT,
+  };
 
-  auto pipeline = auto_gobject_ptr<GstElement>(
-      gst_element_factory_make("playbin", "audio-player-url"),
-      adopt_mode::ref_sink);
-  g_object_set(G_OBJECT(pipeline.get()), "audio-sink", sink.get(), nullptr);
+  // the configuration is only read on the main thread
+  std::vector<std::pair<Sound_t, std::string>> paths;
+  for (Sound_t id : all_sounds) {
+    const gchar *location = sound_location(id);
+    if (!location || strlen(location) < 1)
+      continue;
+
+    gchar *path = resolve_location(location);
+    paths.emplace_back(id, path);
+    g_free(path);
+  }
+
+  preload_thread = std::thread([this, paths]() {
+    size_t count = 0;
+    for (const auto &it : paths) {
+      if (preload_cancelled.load())
+        return;
+
+      GBytes *pcm = decode_sound(it.second.c_str());
+      if (!pcm)
+        continue;
+      count++;
+      g_debug("Preloaded sound %s (%zu bytes)", it.second.c_str(),
+              g_bytes_get_size(pcm));
 
-  url_pipeline.init(this, pipeline);
+      std::lock_guard<std::mutex> lock(preload_mutex);
+      preloaded.emplace_back(it.first, pcm);
+      if (!preload_idle_id)
+        preload_idle_id = g_idle_add(on_sounds_preloaded, this);
+    }
+    g_message("Preloaded %zu sounds", count);
+  });
+}
+
+/**
+ * @brief Make the sounds decoded so far available to `play_sound`. Runs on
+ * the main thread.
+ */
+gboolean genie::AudioPlayer::on_sounds_preloaded(gpointer data) {
+  AudioPlayer *self = static_cast<AudioPlayer *>(data);
+  std::lock_guard<std::mutex> lock(self->preload_mutex);
+  for (auto &it : self->preloaded)
+    self->sounds[it.first].reset(it.second);
+  self->preloaded.clear();
+  self->preload_idle_id = 0;
+  return G_SOURCE_REMOVE;
 }
 
 void genie::AudioPlayer::PipelineState::init(
@@ -188,40 +1005,20 @@ void genie::AudioPlayer::PipelineState::init(
 gboolean genie::AudioPlayer::bus_call_queue(GstBus *bus, GstMessage *msg,
                                             gpointer data) {
   AudioPlayer *obj = static_cast<AudioPlayer *>(data);
+  // the lanes play at the same time, find the one whose task posted the
+  // message; pipelines that are not playing a task are ignored
+  Lane *lane = nullptr;
+  for (Lane *candidate : {&obj->foreground, &obj->music}) {
+    if (candidate->playing_task && candidate->playing_task->owns_message(msg))
+      lane = candidate;
+  }
+
   switch (GST_MESSAGE_TYPE(msg)) {
-    case GST_MESSAGE_STREAM_STATUS:
-      // PROF_PRINT("Stream status changed\n");
-
-      // Dig into the status message... we want to know when the audio
-      // stream starts, 'cause that's what we consider the when we deliver
-      // to the user -- it ends both the TTS window and entire run of
-      // processing tracking.
-      GstStreamStatusType type;
-      GstElement *owner;
-      gst_message_parse_stream_status(msg, &type, &owner);
-
-      // By printing all status events and timing when the audio starts
-      // it seems like we want the "enter" type event.
-      //
-      // There are actually _two_ of them fired, and we want the second --
-      // which is convinient for us, because we can track the event _both_
-      // times, with the second time over-writing the first, which results
-      // in the desired state.
-      if (type == GST_STREAM_STATUS_TYPE_ENTER && obj->playing_task) {
-        obj->app->dispatch(new state::events::PlayerStreamEnter(
-            obj->playing_task->type, obj->playing_task->ref_id));
-      }
-      break;
     case GST_MESSAGE_EOS:
+      if (!lane)
+        break;
       g_message("End of stream");
-      if (obj->playing_task) {
-          obj->app->dispatch(new state::events::PlayerStreamEnd(
-              obj->playing_task->type, obj->playing_task->ref_id));
-          obj->playing_task->stop();
-      }
-      obj->playing_task = nullptr;
-      obj->playing = false;
-      obj->dispatch_queue();
+      obj->on_task_done(lane->playing_task.get());
       break;
     case GST_MESSAGE_ERROR: {
       gchar *debug;
@@ -232,14 +1029,30 @@ gboolean genie::AudioPlayer::bus_call_queue(GstBus *bus, GstMessage *msg,
       g_printerr("Error: %s\n", error->message);
       g_error_free(error);
 
-      if (obj->playing_task) {
-        obj->playing_task->stop();
-        obj->playing_task = nullptr;
-        obj->playing = false;
-      }
+      if (!lane || lane->playing_task->on_error())
+        break;
+
+      // let the next segment of the same utterance announce the stream
+      if (lane->playing_task->dispatch_enter && !lane->queue.empty() &&
+          lane->queue.front()->ref_id == lane->playing_task->ref_id)
+        lane->queue.front()->dispatch_enter = true;
+
+      obj->drop_playing_task(*lane);
       obj->dispatch_queue();
       break;
     }
+    case GST_MESSAGE_ASYNC_DONE:
+      if (lane)
+        lane->playing_task->on_async_done();
+      break;
+    case GST_MESSAGE_BUFFERING: {
+      if (!lane)
+        break;
+      gint percent;
+      gst_message_parse_buffering(msg, &percent);
+      lane->playing_task->on_buffering(percent);
+      break;
+    }
     default:
       break;
   }
@@ -247,25 +1060,168 @@ gboolean genie::AudioPlayer::bus_call_queue(GstBus *bus, GstMessage *msg,
   return true;
 }
 
-gboolean genie::AudioPlayer::play_sound(enum Sound_t id,
-                                        AudioDestination destination) {
+genie::AudioPlayer::Lane *genie::AudioPlayer::find_lane(AudioTask *task) {
+  for (Lane *lane : {&foreground, &music}) {
+    if (lane->playing_task.get() == task)
+      return lane;
+  }
+  return nullptr;
+}
+
+/**
+ * @brief Called on the main thread once the first buffer of the playing task
+ * of `lane` reached the device path.
+ *
+ * The task becomes audible when that buffer comes out of the sink, after the
+ * latency the sink reports.
+ */
+void genie::AudioPlayer::on_task_audible(Lane &lane) {
+  AudioTask *task = lane.playing_task.get();
+  gint64 t_first = lane.t_first_buffer.load();
+  // the task ended before the callback ran, or another callback already
+  // handled this buffer
+  if (!task || t_first == 0 || lane.audible)
+    return;
+  lane.audible = true;
+
+  gint64 t_audible = t_first + GST_TIME_AS_USECONDS(sink_latency(task));
+  app->tracer->span("player.first_audio", lane.t_task_started, t_audible);
+  if (task->latency_stat) {
+    app->stats->record(task->latency_stat,
+                       (t_audible - lane.t_task_started) / 1000.0);
+    app->stats->log_summary(task->latency_stat);
+  }
+
+  // announced once, not again when a preempted task resumes
+  if (task->dispatch_enter) {
+    task->dispatch_enter = false;
+    app->dispatch<state::events::PlayerStreamEnter>(
+        task->type, task->ref_id, t_audible);
+  }
+}
+
+void genie::AudioPlayer::on_task_done(AudioTask *task) {
+  Lane *lane = find_lane(task);
+  g_return_if_fail(lane);
+
+  // keep the ends of the lane in order
+  dispatch_stream_end(*lane);
+  if (task->dispatch_end && task->output) {
+    // the audio of a task playing into an output has only reached the
+    // mixer, hold the end until it has come out of the device
+    GstClockTime remaining = task->output->queued(task->destination) +
+                             task->output->latency();
+    lane->end_type = task->type;
+    lane->end_ref_id = task->ref_id;
+    lane->end_timeout_id = g_timeout_add(GST_TIME_AS_MSECONDS(remaining),
+                                         on_stream_end_timeout, lane);
+  } else if (task->dispatch_end) {
+    app->dispatch<state::events::PlayerStreamEnd>(task->type, task->ref_id);
+  }
+
+  task->complete();
+  drop_playing_task(*lane);
+  dispatch_queue();
+}
+
+/**
+ * @brief Dispatch the PlayerStreamEnd held for `lane`, if any, right away.
+ */
+void genie::AudioPlayer::dispatch_stream_end(Lane &lane) {
+  if (!lane.end_timeout_id)
+    return;
+  g_source_remove(lane.end_timeout_id);
+  lane.end_timeout_id = 0;
+  app->dispatch<state::events::PlayerStreamEnd>(lane.end_type,
+                                                lane.end_ref_id);
+}
+
+gboolean genie::AudioPlayer::on_stream_end_timeout(gpointer data) {
+  Lane *lane = static_cast<Lane *>(data);
+  lane->end_timeout_id = 0;
+  lane->player->app->dispatch<state::events::PlayerStreamEnd>(
+      lane->end_type, lane->end_ref_id);
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Stop the playing task of `lane` and release its output.
+ */
+void genie::AudioPlayer::drop_playing_task(Lane &lane) {
+  if (lane.playing_task) {
+    lane.playing_task->stop();
+    if (lane.playing_task->output && !lane.paused)
+      lane.playing_task->output->release();
+  }
+  lane.playing_task = nullptr;
+  lane.paused = false;
+
+  if (&lane == &music && pause_timeout_id) {
+    g_source_remove(pause_timeout_id);
+    pause_timeout_id = 0;
+  }
+}
+
+const gchar *genie::AudioPlayer::sound_location(Sound_t id) {
   switch (id) {
     case Sound_t::WAKE:
-      return play_location(app->config->sound_wake, destination);
+      return app->config->sound_wake;
     case Sound_t::NO_INPUT:
-      return play_location(app->config->sound_no_input, destination);
+      return app->config->sound_no_input;
     case Sound_t::TOO_MUCH_INPUT:
-      return play_location(app->config->sound_too_much_input, destination);
+      return app->config->sound_too_much_input;
     case Sound_t::NEWS_INTRO:
-      return play_location(app->config->sound_news_intro, destination);
+      return app->config->sound_news_intro;
     case Sound_t::ALARM_CLOCK_ELAPSED:
-      return play_location(app->config->sound_alarm_clock_elapsed, destination);
+      return app->config->sound_alarm_clock_elapsed;
     case Sound_t::WORKING:
-      return play_location(app->config->sound_working, destination);
+      return app->config->sound_working;
     case Sound_t::STT_ERROR:
-      return play_location(app->config->sound_stt_error, destination);
+      return app->config->sound_stt_error;
   }
-  return false;
+  return nullptr;
+}
+
+gchar *genie::AudioPlayer::resolve_location(const gchar *location) {
+  if (*location == '/')
+    return g_strdup(location);
+  else
+    return g_build_filename(app->config->asset_dir, location, nullptr);
+}
+
+gboolean genie::AudioPlayer::play_sound(enum Sound_t id,
+                                        AudioDestination destination) {
+  auto it = sounds.find(id);
+  if (it != sounds.end()) {
+    g_message("Queueing preloaded sound %d for playback", (int)id);
+    std::unique_ptr<AudioTask> task;
+    if (app->config->audio_hot_sink)
+      task = std::make_unique<SoundAudioTask>(this, get_output(destination),
+                                              destination, it->second.get());
+    else
+      task = std::make_unique<SoundAudioTask>(
+          this, get_sound_pipeline(destination), destination,
+          it->second.get());
+    task->latency_stat = "player.sound_latency_ms";
+    enqueue(std::move(task));
+    return true;
+  }
+
+  const gchar *location = sound_location(id);
+  if (!location || strlen(location) < 1)
+    return false;
+
+  gchar *path = resolve_location(location);
+  gchar *uri = g_strdup_printf("file://%s", path);
+  g_message("Queueing %s for playback", uri);
+
+  auto task = make_url_task({uri}, destination, -1);
+  task->latency_stat = "player.sound_latency_ms";
+  enqueue(std::move(task));
+
+  g_free(uri);
+  g_free(path);
+  return true;
 }
 
 gboolean genie::AudioPlayer::play_location(const gchar *location,
@@ -273,11 +1229,7 @@ gboolean genie::AudioPlayer::play_location(const gchar *location,
   if (!location || strlen(location) < 1)
     return false;
 
-  gchar *path;
-  if (*location == '/')
-    path = g_strdup(location);
-  else
-    path = g_build_filename(app->config->asset_dir, location, nullptr);
+  gchar *path = resolve_location(location);
   gchar *uri = g_strdup_printf("file://%s", path);
 
   gboolean ok = play_url(uri, destination);
@@ -295,48 +1247,485 @@ bool genie::AudioPlayer::play_url(const std::string &uri,
 
   g_message("Queueing %s for playback", uri.c_str());
 
-  player_queue.push(
-      std::make_unique<URLAudioTask>(url_pipeline.pipeline, uri, ref_id));
-  dispatch_queue();
+  enqueue(make_url_task({uri}, destination, ref_id));
   return true;
 }
 
+/**
+ * @brief Play `urls` one after the other, without gaps.
+ */
+bool genie::AudioPlayer::play_urls(const std::vector<std::string> &urls,
+                                   AudioDestination destination,
+                                   gint64 ref_id) {
+  if (urls.empty())
+    return false;
+
+  g_message("Queueing playlist of %zu URLs for playback", urls.size());
+  enqueue(make_url_task(urls, destination, ref_id));
+  return true;
+}
+
+/**
+ * @brief Create a task playing `urls` through the URL pipeline of the lane of
+ * `destination`.
+ */
+std::unique_ptr<genie::AudioTask>
+genie::AudioPlayer::make_url_task(const std::vector<std::string> &urls,
+                                  AudioDestination destination,
+                                  gint64 ref_id) {
+  // the foreground URL pipeline plays to the alert branch
+  if (destination != AudioDestination::MUSIC)
+    destination = AudioDestination::ALERT;
+
+  bool prerolled = destination == AudioDestination::MUSIC &&
+                   !standby_url.empty() && standby_url == urls[0];
+  const auto_gobject_ptr<GstElement> &pipeline =
+      prerolled ? standby_url_pipeline.pipeline
+      : destination == AudioDestination::MUSIC ? url_pipeline.pipeline
+                                               : alert_url_pipeline.pipeline;
+  auto task = std::make_unique<URLAudioTask>(pipeline, urls, ref_id);
+  task->destination = destination;
+  if (prerolled) {
+    g_message("Using the prerolled pipeline for %s", urls[0].c_str());
+    task->prerolled = true;
+    // the task owns the pipeline now
+    standby_url.clear();
+    if (standby_timeout_id) {
+      g_source_remove(standby_timeout_id);
+      standby_timeout_id = 0;
+    }
+  }
+  if (app->config->audio_hot_sink)
+    task->output = get_output(destination);
+  return task;
+}
+
+void genie::AudioPlayer::preroll_urls(const std::vector<std::string> &urls) {
+  if (urls.empty() || !standby_url_pipeline.pipeline)
+    return;
+  // the event is deferred again by each state until it can play
+  if (standby_url == urls[0])
+    return;
+  if (pipeline_in_use(standby_url_pipeline)) {
+    g_debug("Standby pipeline busy, not prerolling %s", urls[0].c_str());
+    return;
+  }
+
+  g_message("Prerolling %s", urls[0].c_str());
+  GstElement *pipeline = standby_url_pipeline.pipeline.get();
+  gst_element_set_state(pipeline, GST_STATE_READY);
+  g_object_set(G_OBJECT(pipeline), "uri", urls[0].c_str(), nullptr);
+  // PAUSED connects, buffers and decodes up to the first sample
+  gst_element_set_state(pipeline, GST_STATE_PAUSED);
+  standby_url = urls[0];
+
+  // do not hold on to the stream forever if it is never played
+  if (standby_timeout_id)
+    g_source_remove(standby_timeout_id);
+  standby_timeout_id = g_timeout_add_seconds(
+      STANDBY_TIMEOUT_S,
+      [](gpointer data) {
+        AudioPlayer *self = static_cast<AudioPlayer *>(data);
+        self->standby_timeout_id = 0;
+        self->release_standby();
+        return G_SOURCE_REMOVE;
+      },
+      this);
+}
+
+void genie::AudioPlayer::release_standby() {
+  if (standby_url.empty())
+    return;
+
+  g_debug("Releasing the prerolled %s", standby_url.c_str());
+  gst_element_set_state(standby_url_pipeline.pipeline.get(), GST_STATE_READY);
+  standby_url.clear();
+}
+
+/**
+ * @brief Check if a task playing or queued in the music lane uses the
+ * pipeline of `state`.
+ */
+bool genie::AudioPlayer::pipeline_in_use(const PipelineState &state) {
+  GstElement *pipeline = state.pipeline.get();
+  if (music.playing_task && music.playing_task->get_pipeline() == pipeline)
+    return true;
+  for (auto &task : music.queue) {
+    if (task->get_pipeline() == pipeline)
+      return true;
+  }
+  return false;
+}
+
+void genie::AudioPlayer::enqueue(std::unique_ptr<AudioTask> task) {
+  schedule(std::move(task));
+  dispatch_queue();
+}
+
+static genie::AudioPriority priority_for(genie::AudioDestination destination) {
+  switch (destination) {
+    case genie::AudioDestination::VOICE:
+      return genie::AudioPriority::VOICE;
+    case genie::AudioDestination::ALERT:
+      return genie::AudioPriority::ALERT;
+    case genie::AudioDestination::MUSIC:
+      return genie::AudioPriority::MUSIC;
+  }
+  return genie::AudioPriority::MUSIC;
+}
+
+static const char *priority_wait_stat(genie::AudioPriority priority) {
+  switch (priority) {
+    case genie::AudioPriority::VOICE:
+      return "player.voice_queue_wait_ms";
+    case genie::AudioPriority::ALERT:
+      return "player.alert_queue_wait_ms";
+    case genie::AudioPriority::MUSIC:
+      return "player.music_queue_wait_ms";
+  }
+  return "player.music_queue_wait_ms";
+}
+
+/**
+ * @brief Queue `task` in its lane, by priority, preempting the playing task
+ * if it has a lower priority. The caller dispatches the queue.
+ */
+void genie::AudioPlayer::schedule(std::unique_ptr<AudioTask> task) {
+  task->priority = priority_for(task->destination);
+  // an alert that could not play in time is not worth playing late
+  if (task->priority == AudioPriority::ALERT &&
+      app->config->audio_alert_deadline_ms > 0)
+    task->deadline = task->get_t_queued() +
+                     app->config->audio_alert_deadline_ms * 1000;
+
+  Lane &lane = lane_for(task->destination);
+  if (lane.playing_task && !lane.paused &&
+      lane.playing_task->priority < task->priority)
+    preempt(lane);
+  // without the hot sinks, each lane would open the device on its own, so
+  // the foreground takes it from the music instead of playing over it; music
+  // paused by the user still holds the device, and is suspended as well
+  if (!app->config->audio_hot_sink && &lane == &foreground &&
+      music.playing_task) {
+    if (music.paused)
+      music.playing_task->suspend();
+    else
+      preempt(music);
+  }
+
+  insert_by_priority(lane, std::move(task));
+}
+
+/**
+ * @brief Insert `task` after the queued tasks of the same or higher
+ * priority. A preempted task goes back in front of the tasks of its own
+ * priority, to resume before them.
+ */
+void genie::AudioPlayer::insert_by_priority(Lane &lane,
+                                            std::unique_ptr<AudioTask> task) {
+  auto it = lane.queue.begin();
+  while (it != lane.queue.end() &&
+         ((*it)->priority > task->priority ||
+          ((*it)->priority == task->priority && !task->preempted)))
+    ++it;
+  lane.queue.insert(it, std::move(task));
+}
+
+/**
+ * @brief Take the playing task of `lane` off the output, to let a task of
+ * higher priority play. It is paused and queued again if it can resume,
+ * otherwise it is dropped.
+ */
+void genie::AudioPlayer::preempt(Lane &lane) {
+  std::unique_ptr<AudioTask> task = std::move(lane.playing_task);
+  // cut what is already buffered, so the new task plays right away
+  if (task->output) {
+    task->output->flush(task->destination);
+    task->output->release();
+  }
+
+  if (task->can_resume()) {
+    g_message("Preempting task on %s lane, it will resume later", lane.name);
+    // a task with a sink of its own must let go of the device
+    if (task->output)
+      task->pause();
+    else
+      task->suspend();
+    task->preempted = true;
+    insert_by_priority(lane, std::move(task));
+  } else {
+    g_message("Preempting task on %s lane, dropping it", lane.name);
+    task->stop();
+    if (task->dispatch_end)
+      app->dispatch<state::events::PlayerStreamEnd>(task->type, task->ref_id);
+  }
+}
+
 bool genie::AudioPlayer::say(const std::string &text, gint64 ref_id) {
   if (text.empty())
     return false;
 
-  player_queue.push(std::make_unique<SayAudioTask>(
-      say_pipeline.pipeline, soupsrc, text, base_tts_url,
-      app->config->audio_voice, soup_has_post_data, ref_id));
+  std::vector<std::string> segments;
+  if (app->config->tts_split_sentences)
+    segments = split_sentences(text);
+  else
+    segments.push_back(text);
+
+  for (size_t i = 0; i < segments.size(); i++) {
+    const std::string &segment = segments[i];
+
+    std::string cache_key;
+    if (tts_cache)
+      cache_key = TTSCache::make_key(app->config->locale,
+                                     app->config->audio_voice, segment);
+
+    auto task = std::make_unique<SayAudioTask>(
+        say_pipeline.pipeline, saysrc, segment, base_tts_url,
+        app->config->audio_voice, app->config->tts_compressed, ref_id,
+        tts_cache.get(), cache_key, app->get_soup_session(),
+        app->stats.get(), app->tracer.get());
+    task->destination = AudioDestination::VOICE;
+    if (app->config->audio_hot_sink)
+      task->output = get_output(AudioDestination::VOICE);
+    task->dispatch_enter = i == 0;
+    task->dispatch_end = i == segments.size() - 1;
+    schedule(std::move(task));
+  }
+  g_debug("Queued %zu TTS segments for text id=%" G_GINT64_FORMAT,
+          segments.size(), ref_id);
   dispatch_queue();
 
   return true;
 }
 
+/**
+ * @brief Split `text` at sentence boundaries, so that each sentence can be
+ * synthesized and played on its own.
+ *
+ * A boundary is a run of `.`, `!` or `?` followed by whitespace. Short
+ * sentences are merged into the following one, which keeps abbreviations
+ * ("Dr. Smith") together and avoids a TTS round-trip per word.
+ */
+std::vector<std::string>
+genie::AudioPlayer::split_sentences(const std::string &text) {
+  static const size_t MIN_SEGMENT_LENGTH = 24;
+
+  std::vector<std::string> segments;
+  size_t start = 0;
+  size_t i = 0;
+  while (i < text.size()) {
+    char c = text[i++];
+    if (c != '.' && c != '!' && c != '?')
+      continue;
+    while (i < text.size() &&
+           (text[i] == '.' || text[i] == '!' || text[i] == '?'))
+      i++;
+    if (i < text.size() && !g_ascii_isspace(text[i]))
+      continue;
+    if (i - start < MIN_SEGMENT_LENGTH)
+      continue;
+
+    segments.push_back(text.substr(start, i - start));
+    while (i < text.size() && g_ascii_isspace(text[i]))
+      i++;
+    start = i;
+  }
+
+  if (start < text.size()) {
+    if (!segments.empty() && text.size() - start < MIN_SEGMENT_LENGTH)
+      segments.back() += " " + text.substr(start);
+    else
+      segments.push_back(text.substr(start));
+  }
+  return segments;
+}
+
 void genie::AudioPlayer::dispatch_queue() {
-  if (!playing && !player_queue.empty()) {
-    std::unique_ptr<AudioTask> &task = player_queue.front();
-    playing_task = std::move(task);
-    player_queue.pop();
+  dispatch_lane(foreground);
+  dispatch_lane(music);
+  prefetch_queue();
+  update_ducking();
+}
+
+void genie::AudioPlayer::dispatch_lane(Lane &lane) {
+  if (lane.playing_task)
+    return;
+  // the lanes take turns when they do not share an output, see schedule()
+  if (!app->config->audio_hot_sink && &lane == &music &&
+      foreground.playing_task)
+    return;
+
+  gint64 now = g_get_monotonic_time();
+  while (!lane.queue.empty()) {
+    AudioTask *task = lane.queue.front().get();
+    if (!task->deadline || task->deadline >= now || task->preempted)
+      break;
+    g_message("Dropping task queued %" G_GINT64_FORMAT
+              " ms ago on %s lane, past its deadline",
+              (now - task->get_t_queued()) / 1000, lane.name);
+    lane.queue.pop_front();
+  }
+  if (lane.queue.empty())
+    return;
+
+  lane.playing_task = std::move(lane.queue.front());
+  lane.queue.pop_front();
+  AudioTask *task = lane.playing_task.get();
+
+  lane.t_task_started = now;
+  lane.t_first_buffer = 0;
+  lane.audible = false;
+  if (task->output)
+    task->output->acquire();
+
+  if (task->preempted) {
+    g_debug("Resuming preempted task on %s lane", lane.name);
+    task->preempted = false;
+    task->resume();
+    return;
+  }
+
+  g_debug("Starting task on %s lane", lane.name);
+  app->stats->record(priority_wait_stat(task->priority),
+                     (now - task->get_t_queued()) / 1000.0);
+  task->start();
+}
+
+/**
+ * @brief Start downloading the TTS responses of the next queued utterances,
+ * up to `tts_prefetch_depth`, so that they are ready when their turn comes.
+ */
+void genie::AudioPlayer::prefetch_queue() {
+  size_t depth = 0;
+  for (auto &task : foreground.queue) {
+    if (depth >= app->config->tts_prefetch_depth)
+      break;
+    if (task->type != AudioTaskType::SAY)
+      continue;
+    depth++;
 
-    playing_task->start();
-    playing = true;
+    SayAudioTask *say_task = static_cast<SayAudioTask *>(task.get());
+    if (say_task->needs_prefetch())
+      say_task->prefetch();
   }
 }
 
 gboolean genie::AudioPlayer::clean_queue() {
-  if (playing_task)
-    playing_task->stop();
-  playing_task.reset();
-  while (!player_queue.empty()) {
-    player_queue.pop();
+  for (Lane *lane : {&foreground, &music}) {
+    // drop whatever the output has buffered, so that it stops right away
+    AudioTask *task = lane->playing_task.get();
+    if (task && task->output)
+      task->output->flush(task->destination);
+    // the audio the held end was waiting for is gone too
+    dispatch_stream_end(*lane);
+    drop_playing_task(*lane);
+    lane->queue.clear();
   }
-  playing = false;
+  update_ducking();
   return true;
 }
 
+void genie::AudioPlayer::pause() {
+  AudioTask *task = music.playing_task.get();
+  // sounds have no pipeline to pause
+  if (!task || music.paused || !task->get_pipeline())
+    return;
+
+  g_message("Pausing music");
+  task->pause();
+  music.paused = true;
+  // the output can close if nothing else plays
+  if (task->output)
+    task->output->release();
+
+  pause_timeout_id = g_timeout_add_seconds(
+      app->config->audio_pause_timeout_s,
+      [](gpointer data) {
+        AudioPlayer *self = static_cast<AudioPlayer *>(data);
+        self->pause_timeout_id = 0;
+        g_message("Music paused for too long, stopping it");
+        self->drop_playing_task(self->music);
+        self->dispatch_queue();
+        return G_SOURCE_REMOVE;
+      },
+      this);
+}
+
+void genie::AudioPlayer::resume() {
+  if (!music.paused) {
+    g_debug("No paused music to resume");
+    return;
+  }
+
+  g_message("Resuming music");
+  if (pause_timeout_id) {
+    g_source_remove(pause_timeout_id);
+    pause_timeout_id = 0;
+  }
+  music.paused = false;
+  // without the hot sinks, the music waits for its turn, see schedule()
+  if (!app->config->audio_hot_sink && foreground.playing_task) {
+    std::unique_ptr<AudioTask> task = std::move(music.playing_task);
+    task->preempted = true;
+    insert_by_priority(music, std::move(task));
+    return;
+  }
+
+  AudioTask *task = music.playing_task.get();
+  if (task->output)
+    task->output->acquire();
+  task->resume();
+}
+
+void genie::AudioPlayer::duck() {
+  duck_requested = true;
+  update_ducking();
+}
+
+void genie::AudioPlayer::unduck() {
+  duck_requested = false;
+  update_ducking();
+}
+
+/**
+ * @brief Ramp the music branch down while it is ducked, and back up after.
+ *
+ * This needs the hot sinks: without them the music has no branch to ramp,
+ * and only the driver can duck it. While the driver ducks, the branch is
+ * left alone, so that the music is not lowered twice.
+ */
+void genie::AudioPlayer::update_ducking() {
+  if (!app->config->audio_hot_sink)
+    return;
+
+  bool driver_ducked = duck_requested && app->config->audio_driver_ducking;
+  bool should_duck =
+      (duck_requested || foreground.playing_task) && !driver_ducked;
+  if (should_duck == music_ducked)
+    return;
+  music_ducked = should_duck;
+
+  double volume = should_duck ? app->config->audio_duck_volume / 100.0 : 1.0;
+  g_debug("%s music", should_duck ? "Ducking" : "Unducking");
+  get_output(AudioDestination::MUSIC)
+      ->ramp_volume(AudioDestination::MUSIC, volume,
+                    app->config->audio_duck_ramp_ms * GST_MSECOND);
+}
+
+void genie::AudioPlayer::update_metrics() {
+  for (Lane *lane : {&foreground, &music}) {
+    // the playing task counts as queued
+    size_t depth = lane->queue.size() + (lane->playing_task ? 1 : 0);
+    app->metrics
+        ->gauge("genie_player_queue_depth",
+                "Audio tasks queued or playing, by lane.",
+                std::string("lane=\"") + lane->name + "\"")
+        ->set(depth);
+  }
+}
+
 gboolean genie::AudioPlayer::stop() {
-  if (!playing)
+  if (!foreground.playing_task && !music.playing_task)
     return true;
   clean_queue();
   return true;
@@ -19,82 +19,345 @@
 #pragma once
 
 #include "app.hpp"
+#include "audiooutput.hpp"
+#include "ttscache.hpp"
 #include "utils/autoptrs.hpp"
 
 #include <alsa/asoundlib.h>
+#include <atomic>
+#include <deque>
 #include <gst/gst.h>
 #include <json-glib/json-glib.h>
+#include <libsoup/soup.h>
+#include <map>
 #include <memory>
-#include <queue>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace genie {
 
-enum class AudioDestination { VOICE, MUSIC, ALERT };
+class AudioPlayer;
+
+/**
+ * @brief Tasks of higher priority play first, and preempt the playing task
+ * of their lane.
+ */
+enum class AudioPriority { MUSIC, ALERT, VOICE };
 
 class AudioTask {
 protected:
   auto_gobject_ptr<GstElement> pipeline;
-  struct timeval t_start;
+  // monotonic time at which the task was created, in microseconds
+  const gint64 t_queued;
 
 public:
   AudioTaskType type;
   gint64 ref_id;
 
+  /**
+   * When one utterance is split into several tasks sharing the same
+   * `ref_id`, only the first dispatches `PlayerStreamEnter` and only the
+   * last dispatches `PlayerStreamEnd`.
+   */
+  bool dispatch_enter = true;
+  bool dispatch_end = true;
+
+  // branch of the output the task plays into; output is nullptr if the task
+  // has its own sink
+  AudioOutput *output = nullptr;
+  AudioDestination destination = AudioDestination::MUSIC;
+
+  // series recording the delay from start to the first buffer at the sink
+  const char *latency_stat = "player.start_latency_ms";
+
+  AudioPriority priority = AudioPriority::MUSIC;
+  // monotonic time after which the task is dropped instead of played, or 0
+  gint64 deadline = 0;
+  // the task was paused to let a task of higher priority play
+  bool preempted = false;
+
   AudioTask(const auto_gobject_ptr<GstElement> &pipeline, AudioTaskType type,
             gint64 ref_id)
-      : pipeline(pipeline), type(type), ref_id(ref_id) {}
+      : pipeline(pipeline), t_queued(g_get_monotonic_time()), type(type),
+        ref_id(ref_id) {}
   AudioTask(const AudioTask &) = delete;
   AudioTask(AudioTask &&) = delete;
 
-  void stop() { gst_element_set_state(pipeline.get(), GST_STATE_READY); }
+  virtual void stop() { gst_element_set_state(pipeline.get(), idle_state()); }
 
   virtual ~AudioTask() = default;
   virtual void start() = 0;
+
+  /**
+   * @brief Hold the task where it is, keeping its position and buffers.
+   */
+  virtual void pause() {
+    gst_element_set_state(pipeline.get(), GST_STATE_PAUSED);
+  }
+  virtual void resume() {
+    gst_element_set_state(pipeline.get(), GST_STATE_PLAYING);
+  }
+
+  /**
+   * @brief Hold the task like `pause`, and also close its sink, so that
+   * another pipeline can open the device. Resumed by `resume`.
+   */
+  virtual void suspend() { pause(); }
+
+  /**
+   * @brief Called when the task played to the end of the stream.
+   */
+  virtual void complete() {}
+
+  /**
+   * @brief Called when the pipeline of the task reports its buffering level.
+   */
+  virtual void on_buffering(int percent) {}
+
+  /**
+   * @brief Called when the pipeline of the task posts an error.
+   *
+   * @return true if the task recovered and keeps playing, false if it must
+   * be dropped.
+   */
+  virtual bool on_error() { return false; }
+
+  /**
+   * @brief Called when the pipeline of the task completed a state change or
+   * a flushing seek.
+   */
+  virtual void on_async_done() {}
+
+  /**
+   * @brief Check if `msg` was posted by the pipeline of this task.
+   */
+  bool owns_message(GstMessage *msg) const;
+  GstElement *get_pipeline() const { return pipeline.get(); }
+  gint64 get_t_queued() const { return t_queued; }
+
+  /**
+   * @brief Check if the task can be paused when preempted, and resumed
+   * afterwards. Other tasks are dropped.
+   */
+  virtual bool can_resume() const { return false; }
+
+protected:
+  /**
+   * @brief The state a stopped task leaves its pipeline in. A sink keeps
+   * the device open in READY, so a task with a sink of its own goes down to
+   * NULL, to let the other pipelines open the device.
+   */
+  GstState idle_state() const {
+    return output ? GST_STATE_READY : GST_STATE_NULL;
+  }
 };
 
+/**
+ * @brief Play a list of URLs back to back through a playbin.
+ *
+ * The next URL is handed to playbin from its about-to-finish signal, so it
+ * is opened and buffered while the current one is still playing, and there
+ * is no gap between them.
+ */
 class URLAudioTask : public AudioTask {
-  std::string url;
+  std::vector<std::string> urls;
+  // only touched by start(), and by about-to-finish on the streaming thread
+  // while the pipeline is playing
+  size_t next_url = 0;
+  gulong about_to_finish_id = 0;
+  bool is_live = false;
+  bool buffering = false;
+  bool paused = false;
+  // suspend() took the pipeline down, resume() brings it back at the saved
+  // position; seeking is set while it prerolls, before the seek
+  bool suspended = false;
+  bool seeking = false;
+  std::string resume_uri;
+  gint64 resume_position = 0;
 
 public:
+  // the pipeline is already prerolled on the first URL, start() only needs
+  // to set it playing
+  bool prerolled = false;
+
   URLAudioTask(const auto_gobject_ptr<GstElement> &pipeline,
-               const std::string &url, gint64 ref_id)
-      : AudioTask(pipeline, AudioTaskType::URL, ref_id), url(url) {}
+               const std::vector<std::string> &urls, gint64 ref_id)
+      : AudioTask(pipeline, AudioTaskType::URL, ref_id), urls(urls) {}
+  ~URLAudioTask();
 
   void start() override;
+  void stop() override;
+  void pause() override;
+  void resume() override;
+  void suspend() override;
+  bool can_resume() const override { return true; }
+  void on_buffering(int percent) override;
+  bool on_error() override;
+  void on_async_done() override;
+
+private:
+  static void on_about_to_finish(GstElement *playbin, gpointer data);
 };
 
+/**
+ * @brief Speak a TTS response, fetched through the shared SoupSession of the
+ * app and pushed into the pipeline through appsrc.
+ *
+ * Going through the app session keeps the connection to the NL server alive
+ * between utterances, and applies the same proxy and CA settings as the other
+ * requests.
+ *
+ * The response can be WAV, Ogg/Opus or MP3: the caps of appsrc are set from
+ * its content type, and decodebin plugs the matching decoder.
+ */
 class SayAudioTask : public AudioTask {
-  auto_gobject_ptr<GstElement> soupsrc;
+  auto_gobject_ptr<GstElement> saysrc;
   std::string text;
   const std::string &base_tts_url;
   const char *voice;
-  bool soup_has_post_data;
+  // accept compressed responses
+  const bool compressed;
+
+  // TTS cache, or nullptr if disabled
+  TTSCache *const cache;
+  std::string cache_key;
+
+  SoupSession *const session;
+  Stats *const stats;
+  Tracer *const tracer;
+
+  // request for the TTS response, started ahead of playback by prefetch()
+  // or on start()
+  enum class FetchState { NONE, FETCHING, DONE, FAILED };
+  FetchState fetch_state = FetchState::NONE;
+  SoupMessage *message = nullptr;
+  gint64 t_fetch_start = 0;
+  gulong got_headers_id = 0;
+  gulong got_chunk_id = 0;
+  gulong network_event_id = 0;
+  // the request opened a new connection instead of reusing an idle one
+  bool new_connection = false;
+  // content type of the response, once its headers arrived
+  bool got_headers = false;
+  std::string content_type;
+  // the complete response, once downloaded
+  GBytes *response = nullptr;
+  // the task started before the download completed
+  bool streaming = false;
+  // the pipeline of a streaming task started, and chunks are pushed into it
+  // as they arrive
+  bool pushing = false;
+  // cleared on destruction, checked by the fetch callback
+  std::shared_ptr<SayAudioTask *> self_ref;
 
 public:
   SayAudioTask(const auto_gobject_ptr<GstElement> &pipeline,
-               const auto_gobject_ptr<GstElement> &soupsrc,
+               const auto_gobject_ptr<GstElement> &saysrc,
                const std::string &text, const std::string &base_tts_url,
-               const char *voice, bool soup_has_post_data, gint64 ref_id)
-      : AudioTask(pipeline, AudioTaskType::SAY, ref_id), soupsrc(soupsrc),
+               const char *voice, bool compressed, gint64 ref_id,
+               TTSCache *cache, const std::string &cache_key,
+               SoupSession *session, Stats *stats, Tracer *tracer)
+      : AudioTask(pipeline, AudioTaskType::SAY, ref_id), saysrc(saysrc),
         text(text), base_tts_url(base_tts_url), voice(voice),
-        soup_has_post_data(soup_has_post_data) {}
+        compressed(compressed), cache(cache), cache_key(cache_key),
+        session(session), stats(stats), tracer(tracer) {}
+  ~SayAudioTask();
 
   void start() override;
+  void stop() override;
+  void complete() override;
+
+  /**
+   * @brief Download the TTS response into memory ahead of playback.
+   *
+   * If the task is started before the download completes, playback begins
+   * with what was received so far, and follows the rest of the response.
+   */
+  void prefetch();
+  bool needs_prefetch() const;
 
 private:
-  void say_get();
-  void say_post();
+  std::string request_body();
+  void fetch();
+  void cancel_fetch();
+  void release_message();
+  void on_fetch_done(SoupMessage *msg);
+  void start_streaming();
+  void start_pushing();
+  void play_buffered(GBytes *audio, const char *content_type);
+  void set_content_type(const char *content_type);
+  void push_bytes(GBytes *bytes);
+  void post_error(guint status_code);
+
+  static void on_got_headers(SoupMessage *msg, gpointer data);
+  static void on_got_chunk(SoupMessage *msg, SoupBuffer *chunk, gpointer data);
+  static void on_network_event(SoupMessage *msg, GSocketClientEvent event,
+                               GIOStream *connection, gpointer data);
+};
+
+/**
+ * @brief Play a sound decoded at startup.
+ *
+ * In hot sink mode, the sound is pushed straight into its output. There is
+ * no pipeline, and no end-of-stream, so the task completes once the audio
+ * queued on the branch has reached the mixer. Otherwise, the sound plays
+ * through the sound pipeline of its destination, starting with an appsrc
+ * named "src", and completes at its end-of-stream.
+ */
+class SoundAudioTask : public AudioTask {
+  AudioPlayer *const player;
+  GBytes *const pcm;
+  guint done_timeout_id = 0;
+
+public:
+  SoundAudioTask(AudioPlayer *player, AudioOutput *output,
+                 AudioDestination destination, GBytes *pcm)
+      : AudioTask(auto_gobject_ptr<GstElement>(), AudioTaskType::URL, -1),
+        player(player), pcm(g_bytes_ref(pcm)) {
+    this->output = output;
+    this->destination = destination;
+  }
+  SoundAudioTask(AudioPlayer *player,
+                 const auto_gobject_ptr<GstElement> &pipeline,
+                 AudioDestination destination, GBytes *pcm)
+      : AudioTask(pipeline, AudioTaskType::URL, -1), player(player),
+        pcm(g_bytes_ref(pcm)) {
+    this->destination = destination;
+  }
+  ~SoundAudioTask();
+
+  void start() override;
+  void stop() override;
 };
 
 class AudioPlayer {
+  friend class SoundAudioTask;
+
 public:
+  /**
+   * @brief Initialize GStreamer and load its plugin registry. Must be
+   * called once before an AudioPlayer is constructed, from any thread.
+   */
+  static void init_gstreamer();
+
   AudioPlayer(App *appInstance);
+  ~AudioPlayer();
   gboolean play_sound(enum Sound_t id,
                       AudioDestination destination = AudioDestination::ALERT);
   bool play_url(const std::string &url,
                 AudioDestination destination = AudioDestination::MUSIC,
                 gint64 ref_id = -1);
+  bool play_urls(const std::vector<std::string> &urls,
+                 AudioDestination destination = AudioDestination::MUSIC,
+                 gint64 ref_id = -1);
+
+  /**
+   * @brief Open and buffer the first of `urls` ahead of time, so that it
+   * starts right away if it is played with `play_urls` later.
+   */
+  void preroll_urls(const std::vector<std::string> &urls);
   gboolean
   play_location(const gchar *location,
                 AudioDestination destination = AudioDestination::MUSIC);
@@ -102,32 +365,144 @@ public:
   gboolean clean_queue();
   gboolean stop();
 
+  /**
+   * @brief Lower the music, until `unduck` is called. The music is also
+   * ducked on its own while voice or an alert plays over it.
+   */
+  void duck();
+  void unduck();
+
+  /**
+   * @brief Pause the music, keeping its pipeline, position and buffers,
+   * until `resume` is called. After `audio_pause_timeout_s`, the music is
+   * stopped to free its buffers and connection.
+   */
+  void pause();
+  void resume();
+
+  static std::vector<std::string> split_sentences(const std::string &text);
+
+  /**
+   * @brief Refresh the gauges of the queue depth of each lane, before the
+   * metrics are exported.
+   */
+  void update_metrics();
+
 private:
+  /**
+   * @brief A queue of tasks played one after the other. The playing tasks of
+   * different lanes play at the same time, mixed in the output.
+   */
+  struct Lane {
+    const char *const name;
+    std::deque<std::unique_ptr<AudioTask>> queue;
+    std::unique_ptr<AudioTask> playing_task;
+    // the playing task is paused, and does not hold its output
+    bool paused = false;
+
+    AudioPlayer *const player;
+
+    // start of the playing task, and first buffer of the lane reaching the
+    // output after it, set from the streaming thread
+    gint64 t_task_started = 0;
+    std::atomic<gint64> t_first_buffer{0};
+    // the first buffer was handled on the main thread
+    bool audible = false;
+
+    // PlayerStreamEnd of the last task of the lane, held until its audio
+    // has come out of the output
+    guint end_timeout_id = 0;
+    AudioTaskType end_type = AudioTaskType::URL;
+    gint64 end_ref_id = -1;
+
+    Lane(AudioPlayer *player, const char *name) : name(name), player(player) {}
+  };
+  // voice and alerts take turns in the foreground, over the music
+  Lane foreground{this, "foreground"};
+  Lane music{this, "music"};
+
+  // outputs by device, declared before the pipelines feeding them so they
+  // outlive them
+  std::map<std::string, std::unique_ptr<AudioOutput>> outputs;
+
   struct PipelineState {
     auto_gobject_ptr<GstElement> pipeline;
     guint bus_watch_id = 0;
 
     PipelineState() = default;
     ~PipelineState() {
+      if (!pipeline)
+        return;
       g_source_remove(bus_watch_id);
       gst_element_set_state(pipeline.get(), GST_STATE_NULL);
     }
 
     void init(AudioPlayer *self, const auto_gobject_ptr<GstElement> &pipeline);
-  } say_pipeline, url_pipeline;
-  auto_gobject_ptr<GstElement> soupsrc;
+  } say_pipeline, url_pipeline, alert_url_pipeline, standby_url_pipeline;
+  // pipelines of the preloaded sounds when the outputs are not kept open,
+  // created on first use
+  std::map<AudioDestination, PipelineState> sound_pipelines;
+  // URL the standby pipeline is prerolled on, if any
+  static const guint STANDBY_TIMEOUT_S = 60;
+  std::string standby_url;
+  guint standby_timeout_id = 0;
+  guint pause_timeout_id = 0;
+  auto_gobject_ptr<GstElement> saysrc;
+  // sounds decoded to PCM at startup, if preloading is enabled
+  std::map<Sound_t, std::unique_ptr<GBytes, fn_deleter<GBytes, g_bytes_unref>>>
+      sounds;
+  // sounds are decoded on a thread of their own, and handed over to the
+  // main thread as they are ready
+  std::thread preload_thread;
+  std::atomic<bool> preload_cancelled{false};
+  std::mutex preload_mutex;
+  std::vector<std::pair<Sound_t, GBytes *>> preloaded;
+  guint preload_idle_id = 0;
+  std::unique_ptr<TTSCache> tts_cache;
   App *const app;
   std::string base_tts_url;
-  bool soup_has_post_data;
-  bool playing;
+  bool duck_requested = false;
+  bool music_ducked = false;
 
   void init_say_pipeline();
-  void init_url_pipeline();
+  void init_url_pipeline(PipelineState &state, AudioDestination destination,
+                         const char *name);
+  void preload_sounds();
+  static gboolean on_sounds_preloaded(gpointer data);
+  bool pipeline_in_use(const PipelineState &state);
+  void release_standby();
+
+  Lane &lane_for(AudioDestination destination);
+  AudioOutput *get_output(AudioDestination destination);
+  GstElement *make_sink(AudioDestination destination, const char *name);
+  const auto_gobject_ptr<GstElement> &
+  get_sound_pipeline(AudioDestination destination);
+  void watch_first_buffer(GstElement *element, Lane &lane);
+  GstClockTime sink_latency(AudioTask *task);
+  static GstPadProbeReturn on_sink_buffer(GstPad *pad, GstPadProbeInfo *info,
+                                          gpointer data);
+  static gboolean on_first_buffer(gpointer data);
+  const gchar *sound_location(Sound_t id);
+  gchar *resolve_location(const gchar *location);
+  std::unique_ptr<AudioTask>
+  make_url_task(const std::vector<std::string> &urls,
+                AudioDestination destination, gint64 ref_id);
+  void enqueue(std::unique_ptr<AudioTask> task);
+  void schedule(std::unique_ptr<AudioTask> task);
+  void insert_by_priority(Lane &lane, std::unique_ptr<AudioTask> task);
+  void preempt(Lane &lane);
 
+  void on_task_audible(Lane &lane);
+  void on_task_done(AudioTask *task);
+  void dispatch_stream_end(Lane &lane);
+  static gboolean on_stream_end_timeout(gpointer data);
+  Lane *find_lane(AudioTask *task);
+  void drop_playing_task(Lane &lane);
   void dispatch_queue();
+  void dispatch_lane(Lane &lane);
+  void prefetch_queue();
+  void update_ducking();
   static gboolean bus_call_queue(GstBus *bus, GstMessage *msg, gpointer data);
-  std::queue<std::unique_ptr<AudioTask>> player_queue;
-  std::unique_ptr<AudioTask> playing_task;
 };
 
 } // namespace genie
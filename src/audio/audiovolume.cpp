@@ -17,6 +17,7 @@
 // limitations under the License.
 
 #include "audiovolume.hpp"
+#include "audioplayer.hpp"
 
 #include "alsa/volume.hpp"
 #include "pulseaudio/volume.hpp"
@@ -28,9 +29,18 @@ genie::AudioVolumeController::AudioVolumeController(App *app) : app(app) {
     driver = std::make_unique<AudioVolumeDriverPulseAudio>(app);
 }
 
-void genie::AudioVolumeController::duck() { driver->duck(); }
+void genie::AudioVolumeController::duck() {
+  app->audio_player->duck();
+  // only the driver can duck the audio played by other processes
+  if (app->config->audio_driver_ducking)
+    driver->duck();
+}
 
-void genie::AudioVolumeController::unduck() { driver->unduck(); }
+void genie::AudioVolumeController::unduck() {
+  app->audio_player->unduck();
+  if (app->config->audio_driver_ducking)
+    driver->unduck();
+}
 
 void genie::AudioVolumeController::set_volume(int volume) {
   if (volume > MAX_VOLUME) {
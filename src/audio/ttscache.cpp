@@ -0,0 +1,188 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ttscache.hpp"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <memory>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::TTSCache"
+
+// entries can be in any of the encodings of the service, typefinding tells
+// them apart when they are played
+static const char *ENTRY_SUFFIX = ".tts";
+// suffix of the entries from before compressed responses, which are removed
+static const char *LEGACY_SUFFIX = ".wav";
+
+namespace {
+
+struct StoreRequest {
+  genie::TTSCache *cache;
+  std::string key;
+  size_t size;
+};
+
+} // namespace
+
+genie::TTSCache::TTSCache(const char *dir, size_t max_bytes)
+    : dir(dir), max_bytes(max_bytes), total_bytes(0) {
+  if (g_mkdir_with_parents(dir, 0755) < 0) {
+    g_warning("Failed to create TTS cache directory %s: %s", dir,
+              strerror(errno));
+    return;
+  }
+
+  scan();
+  evict();
+  g_message("TTS cache at %s: %zu entries, %zu of %zu bytes used", dir,
+            entries.size(), total_bytes, max_bytes);
+}
+
+std::string genie::TTSCache::make_key(const char *locale, const char *voice,
+                                      const std::string &text) {
+  GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+  // include the terminators so that the fields cannot run into each other
+  g_checksum_update(checksum, (const guchar *)locale, strlen(locale) + 1);
+  g_checksum_update(checksum, (const guchar *)voice, strlen(voice) + 1);
+  g_checksum_update(checksum, (const guchar *)text.c_str(), text.size());
+  std::string key(g_checksum_get_string(checksum));
+  g_checksum_free(checksum);
+  return key;
+}
+
+std::string genie::TTSCache::path_for(const std::string &key) const {
+  return dir + "/" + key + ENTRY_SUFFIX;
+}
+
+void genie::TTSCache::scan() {
+  GError *error = nullptr;
+  GDir *gdir = g_dir_open(dir.c_str(), 0, &error);
+  if (!gdir) {
+    g_warning("Failed to read TTS cache directory: %s", error->message);
+    g_error_free(error);
+    return;
+  }
+
+  const char *name;
+  while ((name = g_dir_read_name(gdir))) {
+    if (g_str_has_suffix(name, LEGACY_SUFFIX)) {
+      unlink((dir + "/" + name).c_str());
+      continue;
+    }
+    // skips temporary files left over by interrupted writes
+    if (!g_str_has_suffix(name, ENTRY_SUFFIX))
+      continue;
+
+    std::string key(name, strlen(name) - strlen(ENTRY_SUFFIX));
+    struct stat st;
+    if (stat(path_for(key).c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+      continue;
+
+    entries[key] = Entry{(size_t)st.st_size, (gint64)st.st_mtime};
+    total_bytes += st.st_size;
+  }
+  g_dir_close(gdir);
+}
+
+void genie::TTSCache::evict() {
+  while (total_bytes > max_bytes && !entries.empty()) {
+    auto oldest = entries.begin();
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+      if (it->second.last_used < oldest->second.last_used)
+        oldest = it;
+    }
+
+    g_debug("Evicting TTS cache entry %s", oldest->first.c_str());
+    unlink(path_for(oldest->first).c_str());
+    total_bytes -= oldest->second.size;
+    entries.erase(oldest);
+  }
+}
+
+GBytes *genie::TTSCache::lookup(const std::string &key) {
+  auto it = entries.find(key);
+  if (it == entries.end())
+    return nullptr;
+
+  std::string path = path_for(key);
+  GError *error = nullptr;
+  GMappedFile *file = g_mapped_file_new(path.c_str(), false, &error);
+  if (!file) {
+    g_warning("Failed to map TTS cache entry %s: %s", key.c_str(),
+              error->message);
+    g_error_free(error);
+    total_bytes -= it->second.size;
+    entries.erase(it);
+    return nullptr;
+  }
+
+  // the bytes keep the mapping alive
+  GBytes *bytes = g_mapped_file_get_bytes(file);
+  g_mapped_file_unref(file);
+
+  it->second.last_used = g_get_real_time() / G_USEC_PER_SEC;
+  utime(path.c_str(), nullptr);
+  return bytes;
+}
+
+void genie::TTSCache::store(const std::string &key, GBytes *data) {
+  size_t size = g_bytes_get_size(data);
+  if (size == 0 || size > max_bytes)
+    return;
+  if (entries.count(key) || pending.count(key))
+    return;
+  pending.insert(key);
+
+  // g_file_replace writes to a temporary file and renames it into place, so
+  // a partially written entry is never picked up
+  GFile *file = g_file_new_for_path(path_for(key).c_str());
+  g_file_replace_contents_bytes_async(file, data, nullptr, false,
+                                      G_FILE_CREATE_NONE, nullptr,
+                                      on_store_done,
+                                      new StoreRequest{this, key, size});
+  g_object_unref(file);
+}
+
+void genie::TTSCache::on_store_done(GObject *source, GAsyncResult *result,
+                                    gpointer data) {
+  std::unique_ptr<StoreRequest> request(static_cast<StoreRequest *>(data));
+  TTSCache *self = request->cache;
+  self->pending.erase(request->key);
+
+  GError *error = nullptr;
+  if (!g_file_replace_contents_finish(G_FILE(source), result, nullptr,
+                                      &error)) {
+    g_warning("Failed to write TTS cache entry %s: %s", request->key.c_str(),
+              error->message);
+    g_error_free(error);
+    return;
+  }
+
+  g_debug("Stored TTS cache entry %s (%zu bytes)", request->key.c_str(),
+          request->size);
+  self->entries[request->key] =
+      Entry{request->size, g_get_real_time() / G_USEC_PER_SEC};
+  self->total_bytes += request->size;
+  self->evict();
+}
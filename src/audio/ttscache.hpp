@@ -0,0 +1,87 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace genie {
+
+/**
+ * @brief On-disk LRU cache of synthesized speech.
+ *
+ * Entries are whole responses from the TTS service, in whichever encoding it
+ * replied with (WAV, Ogg/Opus or MP3), stored as one file per (locale, voice,
+ * text) under `dir`. Files are named after the SHA-256 of the key, with a
+ * `.tts` suffix that does not assume an encoding. Recency is tracked
+ * through the file modification time, so it survives restarts. Once the
+ * total size exceeds the byte budget, the least recently used entries are
+ * removed.
+ *
+ * Must only be used from the main thread.
+ */
+class TTSCache {
+public:
+  TTSCache(const char *dir, size_t max_bytes);
+
+  static std::string make_key(const char *locale, const char *voice,
+                              const std::string &text);
+
+  /**
+   * @brief Look up an entry and mark it as recently used.
+   *
+   * @return The memory-mapped contents of the entry (transfer full), or
+   * `nullptr` if the entry is not in the cache.
+   */
+  GBytes *lookup(const std::string &key);
+
+  bool contains(const std::string &key) const {
+    return entries.count(key) > 0;
+  }
+
+  /**
+   * @brief Add an entry to the cache. The file is written in the background
+   * and only becomes visible to `lookup` once it is complete.
+   */
+  void store(const std::string &key, GBytes *data);
+
+private:
+  struct Entry {
+    size_t size;
+    gint64 last_used;
+  };
+
+  std::string dir;
+  const size_t max_bytes;
+  size_t total_bytes;
+  std::unordered_map<std::string, Entry> entries;
+  std::unordered_set<std::string> pending;
+
+  void scan();
+  void evict();
+  std::string path_for(const std::string &key) const;
+
+  static void on_store_done(GObject *source, GAsyncResult *result,
+                            gpointer data);
+};
+
+} // namespace genie
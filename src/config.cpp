@@ -404,6 +404,10 @@ void genie::Config::load() {
   connect_timeout =
       get_size("general", "connect_timeout", DEFAULT_CONNECT_TIMEOUT);
 
+  event_delay_warn_ms = get_bounded_size("general", "event_delay_warn_ms",
+                                         DEFAULT_EVENT_DELAY_WARN_MS, 0,
+                                         EVENT_DELAY_WARN_MAX_MS);
+
   auth_mode = get_auth_mode(key_file);
   if (auth_mode != AuthMode::NONE) {
     genie_access_token =
@@ -523,6 +527,37 @@ void genie::Config::load() {
 
   audio_voice = get_string("audio", "voice", DEFAULT_VOICE);
 
+  audio_hot_sink = get_bool("audio", "hot_sink", DEFAULT_AUDIO_HOT_SINK);
+  audio_hot_sink_idle_ms =
+      get_bounded_size("audio", "hot_sink_idle_ms",
+                       DEFAULT_AUDIO_HOT_SINK_IDLE_MS, 0,
+                       AUDIO_HOT_SINK_IDLE_MAX_MS);
+
+  audio_url_buffer_ms =
+      get_bounded_size("audio", "url_buffer_ms", DEFAULT_AUDIO_URL_BUFFER_MS,
+                       100, AUDIO_URL_BUFFER_MAX_MS);
+  audio_url_buffer_kb =
+      get_bounded_size("audio", "url_buffer_kb", DEFAULT_AUDIO_URL_BUFFER_KB,
+                       64, AUDIO_URL_BUFFER_MAX_KB);
+
+  audio_alert_deadline_ms = get_bounded_size(
+      "audio", "alert_deadline_ms", DEFAULT_AUDIO_ALERT_DEADLINE_MS, 0,
+      AUDIO_ALERT_DEADLINE_MAX_MS);
+  audio_pause_timeout_s = get_bounded_size("audio", "pause_timeout_s",
+                                           DEFAULT_AUDIO_PAUSE_TIMEOUT_S, 1,
+                                           AUDIO_PAUSE_TIMEOUT_MAX_S);
+  audio_spotifyd_idle_s = get_bounded_size("audio", "spotifyd_idle_s",
+                                           DEFAULT_AUDIO_SPOTIFYD_IDLE_S, 0,
+                                           AUDIO_SPOTIFYD_IDLE_MAX_S);
+
+  audio_duck_volume = get_bounded_size("audio", "duck_volume",
+                                       DEFAULT_AUDIO_DUCK_VOLUME, 0, 100);
+  audio_duck_ramp_ms = get_bounded_size("audio", "duck_ramp_ms",
+                                        DEFAULT_AUDIO_DUCK_RAMP_MS, 0,
+                                        AUDIO_DUCK_RAMP_MAX_MS);
+  audio_driver_ducking =
+      get_bool("audio", "driver_ducking", DEFAULT_AUDIO_DRIVER_DUCKING);
+
   // Echo Cancellation
   // =========================================================================
 
@@ -578,6 +613,7 @@ void genie::Config::load() {
                                          DEFAULT_SOUND_ALARM_CLOCK_ELAPSED);
   sound_working = get_string("sound", "working", DEFAULT_SOUND_WORKING);
   sound_stt_error = get_string("sound", "stt_error", DEFAULT_SOUND_STT_ERROR);
+  sound_preload = get_bool("sound", "preload", DEFAULT_SOUND_PRELOAD);
 
   // Buttons
   // =========================================================================
@@ -733,6 +769,57 @@ void genie::Config::load() {
       "vad", "listen_timeout_ms", DEFAULT_VAD_LISTEN_TIMEOUT_MS,
       VAD_LISTEN_TIMEOUT_MIN_MS, VAD_LISTEN_TIMEOUT_MAX_MS);
 
+  vad_trim_silence =
+      get_bool("vad", "trim_silence", DEFAULT_VAD_TRIM_SILENCE);
+
+  vad_trim_guard_ms = get_bounded_size(
+      "vad", "trim_guard_ms", DEFAULT_VAD_TRIM_GUARD_MS, 0, VAD_TRIM_MAX_MS);
+
+  vad_trim_trailing_ms =
+      get_bounded_size("vad", "trim_trailing_ms", DEFAULT_VAD_TRIM_TRAILING_MS,
+                       0, VAD_TRIM_MAX_MS);
+
+  // TTS
+  // =========================================================================
+  tts_cache = get_bool("tts", "cache", DEFAULT_TTS_CACHE);
+  tts_cache_size_mb = get_bounded_size("tts", "cache_size_mb",
+                                       DEFAULT_TTS_CACHE_SIZE_MB, 1,
+                                       TTS_CACHE_SIZE_MAX_MB);
+  tts_prefetch_depth =
+      get_bounded_size("tts", "prefetch_depth", DEFAULT_TTS_PREFETCH_DEPTH, 0,
+                       TTS_PREFETCH_MAX_DEPTH);
+  tts_split_sentences =
+      get_bool("tts", "split_sentences", DEFAULT_TTS_SPLIT_SENTENCES);
+  tts_compressed = get_bool("tts", "compressed", DEFAULT_TTS_COMPRESSED);
+
+  // Tracing
+  // =========================================================================
+  trace_enabled = get_bool("trace", "enabled", DEFAULT_TRACE_ENABLED);
+  trace_max_files = get_bounded_size("trace", "max_files",
+                                     DEFAULT_TRACE_MAX_FILES, 1,
+                                     TRACE_MAX_FILES_MAX);
+
+  // Flight recorder
+  // =========================================================================
+  recorder_enabled = get_bool("recorder", "enabled", DEFAULT_RECORDER_ENABLED);
+  recorder_seconds = get_bounded_size("recorder", "seconds",
+                                      DEFAULT_RECORDER_SECONDS, 1,
+                                      RECORDER_SECONDS_MAX);
+  recorder_events = get_bounded_size("recorder", "events",
+                                     DEFAULT_RECORDER_EVENTS,
+                                     RECORDER_EVENTS_MIN, RECORDER_EVENTS_MAX);
+  recorder_max_dumps = get_bounded_size("recorder", "max_dumps",
+                                        DEFAULT_RECORDER_MAX_DUMPS, 1,
+                                        RECORDER_MAX_DUMPS_MAX);
+
+  // Main loop watchdog
+  // =========================================================================
+  watchdog_enabled = get_bool("watchdog", "enabled", DEFAULT_WATCHDOG_ENABLED);
+  watchdog_stall_ms = get_bounded_size("watchdog", "stall_ms",
+                                       DEFAULT_WATCHDOG_STALL_MS,
+                                       WATCHDOG_STALL_MS_MIN,
+                                       WATCHDOG_STALL_MS_MAX);
+
   // Web UI
   // =========================================================================
   webui_port =
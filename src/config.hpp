@@ -31,6 +31,8 @@ class Config {
 public:
   static const size_t DEFAULT_WS_RETRY_INTERVAL = 3000;
   static const size_t DEFAULT_CONNECT_TIMEOUT = 5000;
+  static const size_t DEFAULT_EVENT_DELAY_WARN_MS = 250;
+  static const size_t EVENT_DELAY_WARN_MAX_MS = 60000;
   static const size_t VAD_MIN_MS = 100;
   static const size_t VAD_MAX_MS = 5000;
   static const size_t DEFAULT_VAD_START_SPEAKING_MS = 3000;
@@ -42,6 +44,71 @@ public:
   static const size_t VAD_LISTEN_TIMEOUT_MIN_MS = 1000;
   static const size_t VAD_LISTEN_TIMEOUT_MAX_MS = 100000;
 
+  // Silence trimming before audio is streamed to STT
+  static const bool DEFAULT_VAD_TRIM_SILENCE = false;
+  static const size_t DEFAULT_VAD_TRIM_GUARD_MS = 150;
+  static const size_t DEFAULT_VAD_TRIM_TRAILING_MS = 150;
+  static const size_t VAD_TRIM_MAX_MS = 1000;
+
+  // On-disk cache of synthesized speech
+  static const bool DEFAULT_TTS_CACHE = true;
+  static const size_t DEFAULT_TTS_CACHE_SIZE_MB = 16;
+  static const size_t TTS_CACHE_SIZE_MAX_MB = 1024;
+  static const size_t DEFAULT_TTS_PREFETCH_DEPTH = 2;
+  static const size_t TTS_PREFETCH_MAX_DEPTH = 8;
+  static const bool DEFAULT_TTS_SPLIT_SENTENCES = true;
+  static const bool DEFAULT_TTS_COMPRESSED = true;
+
+  // Per-turn traces
+  static const bool DEFAULT_TRACE_ENABLED = false;
+  static const size_t DEFAULT_TRACE_MAX_FILES = 20;
+  static const size_t TRACE_MAX_FILES_MAX = 1000;
+
+  // Flight recorder
+  static const bool DEFAULT_RECORDER_ENABLED = true;
+  static const size_t DEFAULT_RECORDER_SECONDS = 10;
+  static const size_t RECORDER_SECONDS_MAX = 60;
+  static const size_t DEFAULT_RECORDER_EVENTS = 1024;
+  static const size_t RECORDER_EVENTS_MIN = 64;
+  static const size_t RECORDER_EVENTS_MAX = 65536;
+  static const size_t DEFAULT_RECORDER_MAX_DUMPS = 10;
+  static const size_t RECORDER_MAX_DUMPS_MAX = 100;
+
+  // Main loop watchdog
+  static const bool DEFAULT_WATCHDOG_ENABLED = true;
+  static const size_t DEFAULT_WATCHDOG_STALL_MS = 200;
+  static const size_t WATCHDOG_STALL_MS_MIN = 20;
+  static const size_t WATCHDOG_STALL_MS_MAX = 10000;
+
+  // Persistent audio outputs
+  static const bool DEFAULT_AUDIO_HOT_SINK = false;
+  static const size_t DEFAULT_AUDIO_HOT_SINK_IDLE_MS = 30000;
+  static const size_t AUDIO_HOT_SINK_IDLE_MAX_MS = 600000;
+
+  // Network buffering of the URL pipelines
+  static const size_t DEFAULT_AUDIO_URL_BUFFER_MS = 2000;
+  static const size_t AUDIO_URL_BUFFER_MAX_MS = 60000;
+  static const size_t DEFAULT_AUDIO_URL_BUFFER_KB = 2048;
+  static const size_t AUDIO_URL_BUFFER_MAX_KB = 65536;
+
+  // How long an alert can wait in the queue before it is dropped
+  static const size_t DEFAULT_AUDIO_ALERT_DEADLINE_MS = 5000;
+  static const size_t AUDIO_ALERT_DEADLINE_MAX_MS = 60000;
+
+  // How long paused music keeps its pipeline
+  static const size_t DEFAULT_AUDIO_PAUSE_TIMEOUT_S = 600;
+  static const size_t AUDIO_PAUSE_TIMEOUT_MAX_S = 86400;
+
+  // How long spotifyd stays running with nothing playing
+  static const size_t DEFAULT_AUDIO_SPOTIFYD_IDLE_S = 600;
+  static const size_t AUDIO_SPOTIFYD_IDLE_MAX_S = 86400;
+
+  // Ducking
+  static const size_t DEFAULT_AUDIO_DUCK_VOLUME = 20;
+  static const size_t DEFAULT_AUDIO_DUCK_RAMP_MS = 150;
+  static const size_t AUDIO_DUCK_RAMP_MAX_MS = 5000;
+  static const bool DEFAULT_AUDIO_DRIVER_DUCKING = true;
+
   static const constexpr char *DEFAULT_PULSE_AUDIO_OUTPUT_DEVICE = "echosink";
   static const constexpr char *DEFAULT_ALSA_AUDIO_OUTPUT_DEVICE = "hw:0";
   static const constexpr char *DEFAULT_ALSA_AUDIO_VOLUME_CONTROL =
@@ -91,6 +158,7 @@ public:
       "alarm-clock-elapsed.oga";
   static const constexpr char *DEFAULT_SOUND_WORKING = "match.oga";
   static const constexpr char *DEFAULT_SOUND_STT_ERROR = "no-match.oga";
+  static const bool DEFAULT_SOUND_PRELOAD = true;
 
   // Buttons Defaults
   // -------------------------------------------------------------------------
@@ -139,6 +207,12 @@ public:
   gchar *genie_url;
   size_t retry_interval;
   size_t connect_timeout;
+
+  /**
+   * @brief Log a warning when a state event waits longer than this for the
+   * main loop, in milliseconds. 0 disables the warning.
+   */
+  size_t event_delay_warn_ms;
   gchar *genie_access_token;
   gchar *conversation_id;
   gchar *nl_url;
@@ -168,6 +242,58 @@ public:
    */
   bool audio_input_stereo2mono;
 
+  /**
+   * @brief Keep one output open per audio device and feed all the playback
+   * through it, instead of opening the device for each task. Off by
+   * default until the latency it saves is measured on ALSA hardware.
+   */
+  bool audio_hot_sink;
+  /**
+   * @brief How long an unused output stays open before the device is
+   * released.
+   */
+  size_t audio_hot_sink_idle_ms;
+
+  /**
+   * @brief How much of a network stream is buffered ahead of playback, in
+   * time and in size; buffering stops at whichever limit is hit first.
+   */
+  size_t audio_url_buffer_ms;
+  size_t audio_url_buffer_kb;
+
+  /**
+   * @brief How long an alert can wait behind other audio before it is
+   * dropped, or 0 to always play it.
+   */
+  size_t audio_alert_deadline_ms;
+
+  /**
+   * @brief How long paused music keeps its position and buffers before it
+   * is stopped.
+   */
+  size_t audio_pause_timeout_s;
+
+  /**
+   * @brief How long spotifyd keeps running when nothing plays on it. 0
+   * keeps it running as long as there are credentials.
+   */
+  size_t audio_spotifyd_idle_s;
+
+  /**
+   * @brief Volume of the music while it is ducked, in percent.
+   */
+  size_t audio_duck_volume;
+  /**
+   * @brief Duration of the volume ramps when ducking and unducking.
+   */
+  size_t audio_duck_ramp_ms;
+  /**
+   * @brief Duck through the audio driver, which lowers the audio of other
+   * processes such as spotifyd as well. While the driver ducks, the player
+   * does not ramp its own music branch down on top of it.
+   */
+  bool audio_driver_ducking;
+
   // Echo Cancellation
   // -------------------------------------------------------------------------
 
@@ -236,6 +362,12 @@ public:
   gchar *sound_working;
   gchar *sound_stt_error;
 
+  /**
+   * @brief Decode the sounds at startup and play them through a persistent
+   * pipeline, instead of opening and decoding the file on each play.
+   */
+  bool sound_preload;
+
   // Buttons
   // -------------------------------------------------------------------------
   bool buttons_enabled;
@@ -291,6 +423,82 @@ public:
   size_t vad_input_detected_noise_ms;
   size_t vad_listen_timeout_ms;
 
+  /**
+   * @brief Hold back silent frames instead of streaming them to STT.
+   *
+   * Silence between the wake-word and the start of speech is dropped, except
+   * for the last `vad_trim_guard_ms`. Trailing silence is forwarded for
+   * `vad_trim_trailing_ms`, then held back until either speech resumes (and
+   * the held frames are sent) or the end of speech is detected (and they are
+   * dropped).
+   */
+  bool vad_trim_silence;
+  size_t vad_trim_guard_ms;
+  size_t vad_trim_trailing_ms;
+
+  // Text-To-Speech (TTS)
+  // -------------------------------------------------------------------------
+
+  /**
+   * @brief Keep synthesized speech in `cache_dir/tts`, so that repeated
+   * responses play without a round-trip to the TTS service.
+   */
+  bool tts_cache;
+  size_t tts_cache_size_mb;
+
+  /**
+   * @brief Number of queued utterances whose TTS response is downloaded
+   * while an earlier one is playing. 0 disables prefetching.
+   */
+  size_t tts_prefetch_depth;
+
+  /**
+   * @brief Synthesize long replies one sentence at a time, so that the first
+   * sentence plays while the rest is being synthesized.
+   */
+  bool tts_split_sentences;
+
+  /**
+   * @brief Ask the TTS service for Opus or MP3 instead of WAV. The reply is
+   * decoded according to its content type, so a service that ignores the
+   * request and keeps sending WAV still plays.
+   */
+  bool tts_compressed;
+
+  // Tracing
+  // -------------------------------------------------------------------------
+
+  /**
+   * @brief Write a Chrome trace of each turn to `cache_dir/traces`, keeping
+   * the `trace_max_files` most recent.
+   */
+  bool trace_enabled;
+  size_t trace_max_files;
+
+  // Flight recorder
+  // -------------------------------------------------------------------------
+
+  /**
+   * @brief Keep the last `recorder_seconds` of input audio and the last
+   * `recorder_events` events in memory, and dump them to
+   * `cache_dir/recordings` when a turn fails or the Web UI asks for it.
+   */
+  bool recorder_enabled;
+  size_t recorder_seconds;
+  size_t recorder_events;
+  size_t recorder_max_dumps;
+
+  // Main loop watchdog
+  // -------------------------------------------------------------------------
+
+  /**
+   * @brief Watch the main loop from a separate thread, and log a backtrace
+   * of the main thread when it is blocked for more than
+   * `watchdog_stall_ms`.
+   */
+  bool watchdog_enabled;
+  size_t watchdog_stall_ms;
+
   // Web UI
   // -------------------------------------------------------------------------
   int webui_port;
@@ -64,17 +64,17 @@ gboolean genie::EVInput::event_dispatch(GSource *g_source, GSourceFunc callback,
         //
         switch (ev.code) {
           case KEY_VOLUMEUP:
-            ev_input->app->dispatch(new state::events::AdjustVolume(1));
+            ev_input->app->dispatch<state::events::AdjustVolume>(1);
             break;
           case KEY_VOLUMEDOWN:
-            ev_input->app->dispatch(new state::events::AdjustVolume(-1));
+            ev_input->app->dispatch<state::events::AdjustVolume>(-1);
             break;
           case KEY_MUTE:
-            ev_input->app->dispatch(new state::events::ToggleDisabled());
+            ev_input->app->dispatch<state::events::ToggleDisabled>();
             break;
           case KEY_PLAYPAUSE:
-            // ev_input->app->dispatch(new state::events::TogglePlayback());
-            ev_input->app->dispatch(new state::events::Panic());
+            // ev_input->app->dispatch<state::events::TogglePlayback>();
+            ev_input->app->dispatch<state::events::Panic>();
             break;
           default:
             g_warning("Unhandled button up event, code=%d", ev.code);
@@ -0,0 +1,284 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "flightrecorder.hpp"
+#include "utils/autoptrs.hpp"
+
+#include <algorithm>
+#include <errno.h>
+#include <json-glib/json-glib.h>
+#include <string.h>
+#include <unistd.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::FlightRecorder"
+
+static const char *TRACK_NAMES[] = {"mic", "playback", "input"};
+
+genie::FlightRecorder::FlightRecorder()
+    : is_enabled(false), seconds(0), max_dumps(0) {}
+
+genie::FlightRecorder::FlightRecorder(const char *dir, size_t seconds,
+                                      size_t max_events, size_t max_dumps)
+    : is_enabled(true), dir(dir), seconds(seconds), max_dumps(max_dumps),
+      events(max_events) {
+  if (g_mkdir_with_parents(dir, 0755) < 0) {
+    g_warning("Failed to create flight recorder directory %s: %s", dir,
+              strerror(errno));
+  }
+  g_message("Flight recorder keeping %zu s of audio and %zu events, dumps "
+            "in %s",
+            seconds, max_events, dir);
+}
+
+void genie::FlightRecorder::start_audio(size_t sample_rate) {
+  if (!is_enabled)
+    return;
+
+  this->sample_rate = sample_rate;
+  for (AudioRing &ring : tracks)
+    ring.samples.resize(seconds * sample_rate);
+  audio_enabled = true;
+}
+
+void genie::FlightRecorder::push_audio(Track track, const int16_t *samples,
+                                       size_t count) {
+  AudioRing &ring = tracks[(size_t)track];
+  size_t capacity = ring.samples.size();
+  // only the end of a block larger than the ring is kept
+  if (count > capacity) {
+    samples += count - capacity;
+    count = capacity;
+  }
+
+  std::lock_guard<std::mutex> lock(ring.mutex);
+  size_t start = ring.written % capacity;
+  size_t first = std::min(count, capacity - start);
+  memcpy(&ring.samples[start], samples, first * sizeof(int16_t));
+  memcpy(&ring.samples[0], samples + first, (count - first) * sizeof(int16_t));
+  ring.written += count;
+}
+
+void genie::FlightRecorder::push_event(const char *kind, const char *name) {
+  gint64 t = g_get_monotonic_time();
+  std::lock_guard<std::mutex> lock(events_mutex);
+  events[events_written % events.size()] = Entry{t, kind, name};
+  events_written++;
+}
+
+std::string genie::FlightRecorder::dump(const char *reason, bool forced) {
+  if (!is_enabled)
+    return "";
+
+  gint64 now = g_get_monotonic_time();
+  if (!forced && t_last_dump && now - t_last_dump < MIN_DUMP_INTERVAL_US) {
+    g_debug("Skipping flight recorder dump (%s), the last one was %.1f s ago",
+            reason, (now - t_last_dump) / (double)G_USEC_PER_SEC);
+    return "";
+  }
+  t_last_dump = now;
+
+  prune();
+
+  GDateTime *date = g_date_time_new_now_local();
+  gchar *stamp = g_date_time_format(date, "%Y%m%d-%H%M%S");
+  // forced dumps can come within the same second
+  gchar *name = g_strdup_printf("%s-%03d-%s", stamp,
+                                g_date_time_get_microsecond(date) / 1000,
+                                reason);
+  std::string path = dir + "/" + name;
+  g_date_time_unref(date);
+  g_free(stamp);
+  g_free(name);
+
+  if (g_mkdir_with_parents(path.c_str(), 0755) < 0) {
+    g_warning("Failed to create flight recorder dump %s: %s", path.c_str(),
+              strerror(errno));
+    return "";
+  }
+
+  g_message("Dumping flight recorder to %s (%s)", path.c_str(), reason);
+  write_file(path + "/events.json", build_events(reason));
+  if (audio_enabled) {
+    for (size_t i = 0; i < N_TRACKS; i++) {
+      GBytes *wav = build_wav(tracks[i]);
+      if (wav)
+        write_file(path + "/" + TRACK_NAMES[i] + ".wav", wav);
+    }
+  }
+  return path;
+}
+
+static void put_le16(std::string &out, uint16_t value) {
+  out += (char)(value & 0xff);
+  out += (char)(value >> 8);
+}
+
+static void put_le32(std::string &out, uint32_t value) {
+  put_le16(out, value & 0xffff);
+  put_le16(out, value >> 16);
+}
+
+/**
+ * @brief Copy the recorded audio of `ring`, oldest sample first, into a
+ * 16-bit mono WAV file. Returns `nullptr` if the track is empty.
+ */
+GBytes *genie::FlightRecorder::build_wav(AudioRing &ring) {
+  std::vector<int16_t> pcm;
+  {
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    size_t capacity = ring.samples.size();
+    if (ring.written == 0)
+      return nullptr;
+    if (ring.written <= capacity) {
+      pcm.assign(ring.samples.begin(), ring.samples.begin() + ring.written);
+    } else {
+      size_t start = ring.written % capacity;
+      pcm.assign(ring.samples.begin() + start, ring.samples.end());
+      pcm.insert(pcm.end(), ring.samples.begin(),
+                 ring.samples.begin() + start);
+    }
+  }
+
+  uint32_t data_size = pcm.size() * sizeof(int16_t);
+  std::string wav;
+  wav.reserve(44 + data_size);
+  wav += "RIFF";
+  put_le32(wav, 36 + data_size);
+  wav += "WAVEfmt ";
+  put_le32(wav, 16);
+  put_le16(wav, 1); // PCM
+  put_le16(wav, 1); // mono
+  put_le32(wav, sample_rate);
+  put_le32(wav, sample_rate * sizeof(int16_t));
+  put_le16(wav, sizeof(int16_t));
+  put_le16(wav, 16);
+  wav += "data";
+  put_le32(wav, data_size);
+  // samples are little-endian on all the targets
+  wav.append((const char *)pcm.data(), data_size);
+
+  return g_bytes_new(wav.data(), wav.size());
+}
+
+/**
+ * @brief Serialize the recorded events, oldest first. Times are in
+ * milliseconds before the dump.
+ */
+GBytes *genie::FlightRecorder::build_events(const char *reason) {
+  std::vector<Entry> entries;
+  {
+    std::lock_guard<std::mutex> lock(events_mutex);
+    size_t count = std::min(events_written, events.size());
+    for (size_t i = events_written - count; i < events_written; i++)
+      entries.push_back(events[i % events.size()]);
+  }
+
+  gint64 now = g_get_monotonic_time();
+  auto_gobject_ptr<JsonBuilder> builder(json_builder_new(), adopt_mode::owned);
+  JsonBuilder *b = builder.get();
+  json_builder_begin_object(b);
+  json_builder_set_member_name(b, "reason");
+  json_builder_add_string_value(b, reason);
+  json_builder_set_member_name(b, "sample_rate");
+  json_builder_add_int_value(b, sample_rate);
+  json_builder_set_member_name(b, "events");
+  json_builder_begin_array(b);
+  for (const Entry &entry : entries) {
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "t_ms");
+    json_builder_add_double_value(b, (entry.t - now) / 1000.0);
+    json_builder_set_member_name(b, "kind");
+    json_builder_add_string_value(b, entry.kind);
+    json_builder_set_member_name(b, "name");
+    json_builder_add_string_value(b, entry.name);
+    json_builder_end_object(b);
+  }
+  json_builder_end_array(b);
+  json_builder_end_object(b);
+
+  auto_gobject_ptr<JsonGenerator> gen(json_generator_new(), adopt_mode::owned);
+  JsonNode *root = json_builder_get_root(b);
+  json_generator_set_root(gen.get(), root);
+  json_generator_set_pretty(gen.get(), true);
+  json_node_unref(root);
+  gsize length;
+  gchar *json = json_generator_to_data(gen.get(), &length);
+
+  return g_bytes_new_take(json, length);
+}
+
+void genie::FlightRecorder::write_file(const std::string &path,
+                                       GBytes *contents) {
+  GFile *file = g_file_new_for_path(path.c_str());
+  g_file_replace_contents_bytes_async(file, contents, nullptr, false,
+                                      G_FILE_CREATE_NONE, nullptr,
+                                      on_write_done, g_strdup(path.c_str()));
+  g_object_unref(file);
+  g_bytes_unref(contents);
+}
+
+void genie::FlightRecorder::on_write_done(GObject *source,
+                                          GAsyncResult *result,
+                                          gpointer data) {
+  gchar *path = static_cast<gchar *>(data);
+  GError *error = nullptr;
+  if (!g_file_replace_contents_finish(G_FILE(source), result, nullptr,
+                                      &error)) {
+    g_warning("Failed to write %s: %s", path, error->message);
+    g_error_free(error);
+  }
+  g_free(path);
+}
+
+/**
+ * @brief Remove the oldest dumps, leaving room for a new one.
+ *
+ * The directory names start with the time of the dump, so they sort by age.
+ */
+void genie::FlightRecorder::prune() {
+  GDir *gdir = g_dir_open(dir.c_str(), 0, nullptr);
+  if (!gdir)
+    return;
+
+  std::vector<std::string> dumps;
+  const char *name;
+  while ((name = g_dir_read_name(gdir))) {
+    std::string path = dir + "/" + name;
+    if (g_file_test(path.c_str(), G_FILE_TEST_IS_DIR))
+      dumps.push_back(name);
+  }
+  g_dir_close(gdir);
+
+  if (dumps.size() < max_dumps)
+    return;
+  std::sort(dumps.begin(), dumps.end());
+  size_t excess = dumps.size() - max_dumps + 1;
+  for (size_t i = 0; i < excess; i++) {
+    std::string path = dir + "/" + dumps[i];
+    g_debug("Removing flight recorder dump %s", path.c_str());
+
+    GDir *dump_dir = g_dir_open(path.c_str(), 0, nullptr);
+    if (dump_dir) {
+      while ((name = g_dir_read_name(dump_dir)))
+        unlink((path + "/" + name).c_str());
+      g_dir_close(dump_dir);
+    }
+    rmdir(path.c_str());
+  }
+}
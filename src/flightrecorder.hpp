@@ -0,0 +1,141 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace genie {
+
+/**
+ * @brief Keeps the last seconds of input audio and the last events in
+ * memory, and writes them to disk when a turn goes wrong.
+ *
+ * Each dump is a directory under `dir`, named after the time and the reason,
+ * with a WAV file per audio track and `events.json`. Only the `max_dumps`
+ * most recent dumps are kept.
+ *
+ * Recording is _thread-safe_ and does not allocate: audio is copied into a
+ * preallocated ring per track, and events are kept as pointers to static
+ * names. A disabled recorder returns right away.
+ */
+class FlightRecorder {
+public:
+  enum class Track {
+    // microphone, before echo cancellation
+    MIC,
+    // playback reference of the echo canceller
+    PLAYBACK,
+    // input as fed to the wake-word and STT
+    INPUT,
+  };
+  static const size_t N_TRACKS = 3;
+
+  // dumps triggered by failures closer than this are skipped, so that a
+  // run of false wakes does not fill the disk
+  static const gint64 MIN_DUMP_INTERVAL_US = 10000000;
+
+  /**
+   * @brief Construct a disabled recorder.
+   */
+  FlightRecorder();
+
+  /**
+   * @brief Construct a recorder that keeps `seconds` of audio and
+   * `max_events` events, and writes up to `max_dumps` dumps to `dir`.
+   */
+  FlightRecorder(const char *dir, size_t seconds, size_t max_events,
+                 size_t max_dumps);
+
+  bool enabled() const { return is_enabled; }
+
+  /**
+   * @brief Allocate the audio rings. Must be called before any audio is
+   * recorded, by the owner of the capture thread before starting it.
+   */
+  void start_audio(size_t sample_rate);
+
+  void record_audio(Track track, const int16_t *samples, size_t count) {
+    if (audio_enabled)
+      push_audio(track, samples, count);
+  }
+
+  /**
+   * @brief Record an event of kind `kind` (a state event, a state
+   * transition...) named `name`. Both must outlive the recorder.
+   */
+  void record_event(const char *kind, const char *name) {
+    if (is_enabled)
+      push_event(kind, name);
+  }
+
+  /**
+   * @brief Write the recorded audio and events to a new dump, in the
+   * background. Main thread only.
+   *
+   * @param reason Why the dump was taken, used in its name.
+   * @param forced Skip the rate limit, for dumps requested by the user.
+   * @return The path of the dump, or an empty string if none was taken.
+   */
+  std::string dump(const char *reason, bool forced = false);
+
+private:
+  struct AudioRing {
+    std::mutex mutex;
+    std::vector<int16_t> samples;
+    // total number of samples recorded
+    size_t written = 0;
+  };
+
+  struct Entry {
+    gint64 t;
+    const char *kind;
+    const char *name;
+  };
+
+  const bool is_enabled;
+  const std::string dir;
+  const size_t seconds;
+  const size_t max_dumps;
+  bool audio_enabled = false;
+  size_t sample_rate = 0;
+  gint64 t_last_dump = 0;
+
+  AudioRing tracks[N_TRACKS];
+
+  std::mutex events_mutex;
+  std::vector<Entry> events;
+  size_t events_written = 0;
+
+  void push_audio(Track track, const int16_t *samples, size_t count);
+  void push_event(const char *kind, const char *name);
+  GBytes *build_wav(AudioRing &ring);
+  GBytes *build_events(const char *reason);
+  void write_file(const std::string &path, GBytes *contents);
+  void prune();
+
+  static void on_write_done(GObject *source, GAsyncResult *result,
+                            gpointer data);
+};
+
+} // namespace genie
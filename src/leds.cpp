@@ -194,7 +194,8 @@ int genie::Leds::get_brightness_internal(bool max = false) {
 void genie::Leds::solid(int color) {
   if (update_timer_circular) {
     update_timer_circular = false;
-    usleep(100);
+    // g_usleep() resumes after a signal, such as the watchdog's
+    g_usleep(100);
   }
   clear(color);
   set_leds();
@@ -289,7 +290,7 @@ void genie::Leds::pulse() {
     return;
   if (update_timer_circular) {
     update_timer_circular = false;
-    usleep(100);
+    g_usleep(100);
   }
 
   step_bright = brightness;
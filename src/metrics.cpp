@@ -0,0 +1,251 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "metrics.hpp"
+
+#include <glib.h>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::Metrics"
+
+const std::vector<double> genie::Metrics::LATENCY_BOUNDS = {
+    0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+
+static std::string format_value(double value) {
+  // not printf, the decimal separator must not follow the locale
+  gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+  return g_ascii_formatd(buffer, sizeof(buffer), "%.10g", value);
+}
+
+static std::string escape_label(const std::string &value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '\\' || c == '"')
+      escaped += '\\';
+    if (c == '\n')
+      escaped += "\\n";
+    else
+      escaped += c;
+  }
+  return escaped;
+}
+
+static void render_sample(std::string &out, const std::string &name,
+                          const std::string &labels,
+                          const std::string &value) {
+  out += name;
+  if (!labels.empty())
+    out += "{" + labels + "}";
+  out += " " + value + "\n";
+}
+
+static std::string add_label(const std::string &labels,
+                             const std::string &label) {
+  return labels.empty() ? label : labels + "," + label;
+}
+
+uint64_t genie::Counter::value() const {
+  uint64_t total = 0;
+  for (const Cell &cell : cells)
+    total += cell.value.load(std::memory_order_relaxed);
+  return total;
+}
+
+void genie::Counter::render(std::string &out, const std::string &name,
+                            const std::string &labels) const {
+  render_sample(out, name, labels, std::to_string(value()));
+}
+
+void genie::Gauge::render(std::string &out, const std::string &name,
+                          const std::string &labels) const {
+  render_sample(out, name, labels,
+                format_value(value.load(std::memory_order_relaxed)));
+}
+
+genie::Histogram::Histogram(const std::vector<double> &bounds)
+    : bounds(bounds) {
+  for (Cell &cell : cells)
+    cell.buckets.reset(new std::atomic<uint64_t>[bounds.size() + 1]());
+}
+
+void genie::Histogram::observe(double v) {
+  size_t bucket = 0;
+  while (bucket < bounds.size() && v > bounds[bucket])
+    bucket++;
+
+  Cell &cell = cells[metric_cell()];
+  cell.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  double sum = cell.sum.load(std::memory_order_relaxed);
+  while (!cell.sum.compare_exchange_weak(sum, sum + v,
+                                         std::memory_order_relaxed))
+    ;
+}
+
+void genie::Histogram::render(std::string &out, const std::string &name,
+                              const std::string &labels) const {
+  std::vector<uint64_t> counts(bounds.size() + 1, 0);
+  double sum = 0;
+  for (const Cell &cell : cells) {
+    for (size_t i = 0; i < counts.size(); i++)
+      counts[i] += cell.buckets[i].load(std::memory_order_relaxed);
+    sum += cell.sum.load(std::memory_order_relaxed);
+  }
+
+  // buckets are cumulative in the exposition format
+  uint64_t count = 0;
+  for (size_t i = 0; i < counts.size(); i++) {
+    count += counts[i];
+    std::string le = i < bounds.size() ? format_value(bounds[i]) : "+Inf";
+    render_sample(out, name + "_bucket",
+                  add_label(labels, "le=\"" + le + "\""),
+                  std::to_string(count));
+  }
+  render_sample(out, name + "_sum", labels, format_value(sum));
+  render_sample(out, name + "_count", labels, std::to_string(count));
+}
+
+template <typename M, typename... Args>
+M *genie::Metrics::get(const char *name, const char *type, const char *help,
+                       const std::string &labels, Args &&...args) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Family &family = families[name];
+  if (!family.type) {
+    family.type = type;
+    family.help = help;
+  }
+  g_return_val_if_fail(strcmp(family.type, type) == 0, nullptr);
+
+  std::unique_ptr<Metric> &metric = family.metrics[labels];
+  if (!metric)
+    metric.reset(new M(std::forward<Args>(args)...));
+  return static_cast<M *>(metric.get());
+}
+
+genie::Counter *genie::Metrics::counter(const char *name, const char *help,
+                                        const std::string &labels) {
+  return get<Counter>(name, "counter", help, labels);
+}
+
+genie::Gauge *genie::Metrics::gauge(const char *name, const char *help,
+                                    const std::string &labels) {
+  return get<Gauge>(name, "gauge", help, labels);
+}
+
+genie::Histogram *
+genie::Metrics::histogram(const char *name, const char *help,
+                          const std::string &labels,
+                          const std::vector<double> &bounds) {
+  return get<Histogram>(name, "histogram", help, labels, bounds);
+}
+
+static void render_header(std::string &out, const char *name,
+                          const char *type, const std::string &help) {
+  out += std::string("# HELP ") + name + " " + help + "\n";
+  out += std::string("# TYPE ") + name + " " + type + "\n";
+}
+
+static void render_memory(std::string &out) {
+  gchar *contents;
+  if (!g_file_get_contents("/proc/self/statm", &contents, nullptr, nullptr))
+    return;
+
+  unsigned long size, resident;
+  if (sscanf(contents, "%lu %lu", &size, &resident) == 2) {
+    render_header(out, "genie_process_resident_memory_bytes", "gauge",
+                  "Resident memory size in bytes.");
+    render_sample(out, "genie_process_resident_memory_bytes", "",
+                  std::to_string((uint64_t)resident * sysconf(_SC_PAGESIZE)));
+  }
+  g_free(contents);
+}
+
+/**
+ * @brief Read the name and CPU time (user and system) of thread `tid` from
+ * `/proc/self/task/<tid>/stat`.
+ */
+static bool read_thread_cpu(const char *tid, std::string &name,
+                            double &cpu_s) {
+  gchar *path = g_strdup_printf("/proc/self/task/%s/stat", tid);
+  gchar *contents;
+  bool ok = g_file_get_contents(path, &contents, nullptr, nullptr);
+  g_free(path);
+  if (!ok)
+    return false;
+
+  // the name is in parentheses and can contain anything, including spaces
+  // and parentheses, so the fields are counted from the last ')'
+  const char *open = strchr(contents, '(');
+  const char *close = strrchr(contents, ')');
+  ok = false;
+  if (open && close && close > open) {
+    name.assign(open + 1, close - open - 1);
+    // fields 3 (state) to 15 (stime) of proc(5)
+    unsigned long utime, stime;
+    std::istringstream fields(close + 1);
+    std::string skip;
+    for (int field = 3; field < 14; field++)
+      fields >> skip;
+    if (fields >> utime >> stime) {
+      cpu_s = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+      ok = true;
+    }
+  }
+  g_free(contents);
+  return ok;
+}
+
+static void render_thread_cpu(std::string &out) {
+  GDir *dir = g_dir_open("/proc/self/task", 0, nullptr);
+  if (!dir)
+    return;
+
+  render_header(out, "genie_thread_cpu_seconds_total", "counter",
+                "CPU time spent by each thread, in seconds.");
+  const char *tid;
+  while ((tid = g_dir_read_name(dir))) {
+    std::string name;
+    double cpu_s;
+    if (!read_thread_cpu(tid, name, cpu_s))
+      continue;
+    render_sample(out, "genie_thread_cpu_seconds_total",
+                  "thread=\"" + escape_label(name) + "\",tid=\"" + tid + "\"",
+                  format_value(cpu_s));
+  }
+  g_dir_close(dir);
+}
+
+std::string genie::Metrics::render() {
+  std::string out;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &it : families) {
+      const Family &family = it.second;
+      render_header(out, it.first.c_str(), family.type, family.help);
+      for (const auto &metric : family.metrics)
+        metric.second->render(out, it.first, metric.first);
+    }
+  }
+
+  render_memory(out);
+  render_thread_cpu(out);
+  return out;
+}
@@ -0,0 +1,162 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace genie {
+
+// number of cells each metric is split in; threads are spread over them
+static const size_t METRIC_CELLS = 8;
+
+/**
+ * @brief Index of the metric cell of the calling thread.
+ */
+inline size_t metric_cell() {
+  static std::atomic<size_t> next_cell{0};
+  static thread_local size_t cell =
+      next_cell.fetch_add(1, std::memory_order_relaxed) % METRIC_CELLS;
+  return cell;
+}
+
+class Metric {
+public:
+  virtual ~Metric() = default;
+
+  /**
+   * @brief Append the samples of the metric to `out`, in the Prometheus
+   * text format.
+   */
+  virtual void render(std::string &out, const std::string &name,
+                      const std::string &labels) const = 0;
+};
+
+/**
+ * @brief A monotonically increasing count, such as a number of detections.
+ *
+ * Increments go to the cell of the calling thread with a relaxed atomic add,
+ * so the audio thread never contends with the main thread.
+ */
+class Counter : public Metric {
+public:
+  void inc(uint64_t n = 1) {
+    cells[metric_cell()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+  uint64_t value() const;
+
+  void render(std::string &out, const std::string &name,
+              const std::string &labels) const override;
+
+private:
+  // padded to a cache line, so that threads do not share one
+  struct Cell {
+    std::atomic<uint64_t> value{0};
+    char padding[64 - sizeof(std::atomic<uint64_t>)];
+  };
+  Cell cells[METRIC_CELLS];
+};
+
+/**
+ * @brief A value that goes up and down, such as a queue depth.
+ */
+class Gauge : public Metric {
+public:
+  void set(double v) { value.store(v, std::memory_order_relaxed); }
+
+  void render(std::string &out, const std::string &name,
+              const std::string &labels) const override;
+
+private:
+  std::atomic<double> value{0};
+};
+
+/**
+ * @brief Counts of observations in cumulative buckets, such as latencies in
+ * seconds.
+ */
+class Histogram : public Metric {
+public:
+  explicit Histogram(const std::vector<double> &bounds);
+
+  void observe(double v);
+
+  void render(std::string &out, const std::string &name,
+              const std::string &labels) const override;
+
+private:
+  struct Cell {
+    // one count per bound, and the last one for +Inf
+    std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+    std::atomic<double> sum{0};
+  };
+
+  const std::vector<double> bounds;
+  Cell cells[METRIC_CELLS];
+};
+
+/**
+ * @brief Registry of the metrics exported on the `/metrics` page of the Web
+ * UI, for Prometheus.
+ *
+ * Looking up a metric takes a lock, recording one does not: call sites on a
+ * hot path look their metrics up once and keep the pointer, which stays
+ * valid for the lifetime of the registry. `labels` is the label set of the
+ * metric, in the exposition format, such as `step="stt"`.
+ */
+class Metrics {
+public:
+  // latency buckets, in seconds
+  static const std::vector<double> LATENCY_BOUNDS;
+
+  Counter *counter(const char *name, const char *help,
+                   const std::string &labels = "");
+  Gauge *gauge(const char *name, const char *help,
+               const std::string &labels = "");
+  Histogram *histogram(const char *name, const char *help,
+                       const std::string &labels = "",
+                       const std::vector<double> &bounds = LATENCY_BOUNDS);
+
+  /**
+   * @brief All the metrics, followed by the memory usage of the process and
+   * the CPU time of each of its threads, in the Prometheus text format.
+   */
+  std::string render();
+
+private:
+  struct Family {
+    const char *type = nullptr;
+    std::string help;
+    std::map<std::string, std::unique_ptr<Metric>> metrics;
+  };
+
+  std::mutex mutex;
+  std::map<std::string, Family> families;
+
+  template <typename M, typename... Args>
+  M *get(const char *name, const char *type, const char *help,
+         const std::string &labels, Args &&...args);
+};
+
+} // namespace genie
@@ -32,11 +32,73 @@
 
 #define SPOTIFYD_VERSION "0.3.4"
 
-genie::Spotifyd::Spotifyd(App *app) : app(app), child_pid(-1) {}
+// the version of the binary in cache_dir, written once it is extracted
+#define SPOTIFYD_VERSION_FILE "spotifyd.version"
+
+// the name spotifyd advertises on Spotify Connect
+#define SPOTIFYD_DEVICE_NAME "genie-cpp"
+
+genie::Spotifyd::Spotifyd(App *app)
+    : app(app), child_pid(-1), ready(false), pending_activate(false),
+      unavailable(false), idle_timeout_id(0), device_seen(false),
+      polling_devices(false), poll_timeout_id(0), check_timeout_id(0) {}
+
+genie::Spotifyd::~Spotifyd() {
+  if (idle_timeout_id)
+    g_source_remove(idle_timeout_id);
+  if (poll_timeout_id)
+    g_source_remove(poll_timeout_id);
+  if (check_timeout_id)
+    g_source_remove(check_timeout_id);
+  close();
+}
+
+/**
+ * @brief The Spotify Connect device ID of spotifyd, which is the SHA-1 of
+ * the device name we pass on the command-line.
+ */
+static std::string device_id() {
+  std::unique_ptr<GChecksum, fn_deleter<GChecksum, g_checksum_free>> checksum(
+      g_checksum_new(G_CHECKSUM_SHA1));
+  g_checksum_update(checksum.get(), (const unsigned char *)SPOTIFYD_DEVICE_NAME,
+                    strlen(SPOTIFYD_DEVICE_NAME));
+  return g_checksum_get_string(checksum.get());
+}
 
-genie::Spotifyd::~Spotifyd() { close(); }
+/**
+ * @brief Whether the binary in `cache_dir` is the required version,
+ * according to the version file written after the last download.
+ */
+bool genie::Spotifyd::is_up_to_date() {
+  gchar *file_path = g_build_filename(app->config->cache_dir, "spotifyd",
+                                      nullptr);
+  bool executable = g_file_test(file_path, G_FILE_TEST_IS_EXECUTABLE);
+  g_free(file_path);
+  if (!executable)
+    return false;
 
-int genie::Spotifyd::download() {
+  gchar *version_path = g_build_filename(app->config->cache_dir,
+                                         SPOTIFYD_VERSION_FILE, nullptr);
+  gchar *version = nullptr;
+  g_file_get_contents(version_path, &version, nullptr, nullptr);
+  g_free(version_path);
+  if (version)
+    g_strstrip(version);
+
+  bool up_to_date = g_strcmp0(version, SPOTIFYD_VERSION) == 0;
+  if (!up_to_date) {
+    g_message("spotifyd local version %s, need %s, updating...",
+              version ? version : "unknown", SPOTIFYD_VERSION);
+  }
+  g_free(version);
+  return up_to_date;
+}
+
+/**
+ * @brief Download the release tarball and stream it into `tar`, without
+ * blocking the main loop.
+ */
+void genie::Spotifyd::download() {
   const gchar *dl_arch;
   std::string arch;
   struct utsname un;
@@ -53,67 +115,161 @@ int genie::Spotifyd::download() {
     dl_arch = "";
   }
 
-  gchar *cmd = g_strdup_printf(
-      "curl "
+  gchar *url = g_strdup_printf(
       "https://github.com/stanford-oval/spotifyd/releases/download/v%s/"
-      "spotifyd-linux-%sslim.tar.gz -L | tar -xvz -C %s",
-      SPOTIFYD_VERSION, dl_arch, app->config->cache_dir);
-  int rc = system(cmd);
-  g_free(cmd);
+      "spotifyd-linux-%sslim.tar.gz",
+      SPOTIFYD_VERSION, dl_arch);
+  g_message("Downloading spotifyd from %s", url);
+  download_msg =
+      auto_gobject_ptr<SoupMessage>(soup_message_new("GET", url),
+                                    adopt_mode::owned);
+  g_free(url);
+
+  soup_session_send_async(app->get_soup_session(), download_msg.get(),
+                          nullptr, on_download_sent, this);
+}
+
+void genie::Spotifyd::on_download_sent(GObject *source, GAsyncResult *result,
+                                       gpointer data) {
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  GError *error = nullptr;
+  auto_gobject_ptr<GInputStream> body(
+      soup_session_send_finish(SOUP_SESSION(source), result, &error),
+      adopt_mode::owned);
+  if (error) {
+    g_warning("Failed to download spotifyd: %s", error->message);
+    g_error_free(error);
+    self->download_done(false);
+    return;
+  }
 
-  return rc;
+  guint status_code;
+  g_object_get(self->download_msg.get(), "status-code", &status_code,
+               nullptr);
+  self->download_msg = nullptr;
+  if (status_code != SOUP_STATUS_OK) {
+    g_warning("Failed to download spotifyd: HTTP %u", status_code);
+    self->download_done(false);
+    return;
+  }
+
+  self->extract_proc = auto_gobject_ptr<GSubprocess>(
+      g_subprocess_new(G_SUBPROCESS_FLAGS_STDIN_PIPE, &error, "tar", "-xz",
+                       "-C", self->app->config->cache_dir, nullptr),
+      adopt_mode::owned);
+  if (error) {
+    g_warning("Failed to run tar to extract spotifyd: %s", error->message);
+    g_error_free(error);
+    self->download_done(false);
+    return;
+  }
+
+  g_output_stream_splice_async(
+      g_subprocess_get_stdin_pipe(self->extract_proc.get()), body.get(),
+      (GOutputStreamSpliceFlags)(G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                                 G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET),
+      G_PRIORITY_DEFAULT, nullptr, on_download_spliced, self);
 }
 
-int genie::Spotifyd::check_version() {
-  FILE *fp;
-  char buf[128];
+void genie::Spotifyd::on_download_spliced(GObject *source,
+                                          GAsyncResult *result,
+                                          gpointer data) {
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  GError *error = nullptr;
+  if (g_output_stream_splice_finish(G_OUTPUT_STREAM(source), result, &error) <
+      0) {
+    g_warning("Failed to download spotifyd: %s", error->message);
+    g_error_free(error);
+    // do not let tar succeed on a truncated archive
+    g_subprocess_force_exit(self->extract_proc.get());
+  }
 
-  gchar *cmd = g_strdup_printf("%s/spotifyd --version", app->config->cache_dir);
-  fp = popen(cmd, "r");
-  if (fp == NULL) {
-    g_free(cmd);
-    return true;
+  g_subprocess_wait_check_async(self->extract_proc.get(), nullptr,
+                                on_extract_done, self);
+}
+
+void genie::Spotifyd::on_extract_done(GObject *source, GAsyncResult *result,
+                                      gpointer data) {
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  GError *error = nullptr;
+  bool success =
+      g_subprocess_wait_check_finish(G_SUBPROCESS(source), result, &error);
+  if (!success) {
+    g_warning("Failed to extract spotifyd: %s", error->message);
+    g_error_free(error);
   }
-  g_free(cmd);
-
-  bool update = false;
-  if (fscanf(fp, "spotifyd %127s", buf) == 1) {
-    if (strlen(buf) <= 0) {
-      g_message("unable to get local spotifyd version, updating...");
-      update = true;
-    } else {
-      if (strcmp(SPOTIFYD_VERSION, buf) != 0) {
-        g_message("spotifyd local version %s, need %s, updating...", buf,
-                  SPOTIFYD_VERSION);
-        update = true;
-      }
+  self->extract_proc = nullptr;
+  self->download_done(success);
+}
+
+void genie::Spotifyd::download_done(bool success) {
+  if (success) {
+    gchar *version_path = g_build_filename(app->config->cache_dir,
+                                           SPOTIFYD_VERSION_FILE, nullptr);
+    GError *error = nullptr;
+    if (!g_file_set_contents(version_path, SPOTIFYD_VERSION "\n", -1,
+                             &error)) {
+      g_warning("Failed to write %s: %s", version_path, error->message);
+      g_error_free(error);
+    }
+    g_free(version_path);
+    g_message("spotifyd %s installed", SPOTIFYD_VERSION);
+  } else {
+    // an older binary is better than none
+    gchar *file_path = g_build_filename(app->config->cache_dir, "spotifyd",
+                                        nullptr);
+    success = g_file_test(file_path, G_FILE_TEST_IS_EXECUTABLE);
+    g_free(file_path);
+    if (!success) {
+      g_warning("spotifyd is not available, Spotify playback is disabled");
+      unavailable = true;
+      finish_checks(false, "spotifyd is not available");
+      return;
     }
   }
 
-  if (pclose(fp) == -1) {
-    return true;
+  ready = true;
+  if (pending_activate || app->config->audio_spotifyd_idle_s == 0) {
+    pending_activate = false;
+    activate();
   }
+}
 
-  return update;
+void genie::Spotifyd::on_killall_done(GObject *source, GAsyncResult *result,
+                                      gpointer data) {
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  // killall fails when no spotifyd was running, which is expected
+  g_subprocess_wait_finish(G_SUBPROCESS(source), result, nullptr);
+  g_object_unref(source);
+
+  if (self->is_up_to_date())
+    self->download_done(true);
+  else
+    self->download();
 }
 
+/**
+ * @brief Start provisioning spotifyd in the background: stop any
+ * leftover instance, then download the binary if it is missing or out of
+ * date.
+ */
 int genie::Spotifyd::init() {
-  gchar *cmd = g_strdup_printf("killall spotifyd");
-  system(cmd);
-  g_free(cmd);
-
-  gchar *file_path = g_strdup_printf("%s/spotifyd", app->config->cache_dir);
-  if (!g_file_test(file_path, G_FILE_TEST_IS_EXECUTABLE)) {
-    download();
-  } else {
-    if (check_version()) {
+  GError *error = nullptr;
+  GSubprocess *killall = g_subprocess_new(
+      (GSubprocessFlags)(G_SUBPROCESS_FLAGS_STDOUT_SILENCE |
+                         G_SUBPROCESS_FLAGS_STDERR_SILENCE),
+      &error, "killall", "spotifyd", nullptr);
+  if (error) {
+    g_warning("Failed to run killall: %s", error->message);
+    g_error_free(error);
+    if (is_up_to_date())
+      download_done(true);
+    else
       download();
-    }
+    return true;
   }
-  g_free(file_path);
 
-  if (!username.empty() && !access_token.empty())
-    return spawn();
+  g_subprocess_wait_async(killall, nullptr, on_killall_done, this);
   return true;
 }
 
@@ -150,19 +306,14 @@ static void on_pause_sent(SoupSession *session, SoupMessage *msg,
 }
 
 void genie::Spotifyd::pause() {
-  // compute the device ID of spotifyd
-  // it is the sha1 of the device name
-  // we pass on the command-line
-  std::unique_ptr<GChecksum, fn_deleter<GChecksum, g_checksum_free>> checksum(
-      g_checksum_new(G_CHECKSUM_SHA1));
-  g_checksum_update(checksum.get(), (const unsigned char *)"genie-cpp",
-                    strlen("genie-cpp"));
-  const gchar *device_id = g_checksum_get_string(checksum.get());
+  if (child_pid == -1)
+    return;
 
-  g_debug("Sending request to Spotify to pause spotifyd (%s)", device_id);
+  std::string id = device_id();
+  g_debug("Sending request to Spotify to pause spotifyd (%s)", id.c_str());
   std::unique_ptr<SoupURI, fn_deleter<SoupURI, soup_uri_free>> uri(
       soup_uri_new("https://api.spotify.com/v1/me/player/pause"));
-  soup_uri_set_query_from_fields(uri.get(), "device_id", device_id, nullptr);
+  soup_uri_set_query_from_fields(uri.get(), "device_id", id.c_str(), nullptr);
 
   SoupMessage *msg = soup_message_new_from_uri("PUT", uri.get());
   soup_message_set_request(msg, "application/json", SOUP_MEMORY_STATIC, "", 0);
@@ -185,6 +336,7 @@ void genie::Spotifyd::child_watch_cb(GPid pid, gint status, gpointer data) {
           g_spawn_check_exit_status(status, NULL));
   g_spawn_close_pid(pid);
   obj->child_pid = -1;
+  obj->device_seen = false;
 }
 
 static void child_setup(gpointer user_data) {
@@ -198,7 +350,7 @@ static void child_setup(gpointer user_data) {
 
 int genie::Spotifyd::spawn() {
   gchar *file_path = g_strdup_printf("%s/spotifyd", app->config->cache_dir);
-  const gchar *device_name = "genie-cpp";
+  const gchar *device_name = SPOTIFYD_DEVICE_NAME;
   const char *backend = audio_driver_type_to_string(app->config->audio_backend);
 
   gchar **envp;
@@ -238,6 +390,9 @@ int genie::Spotifyd::spawn() {
 
   g_child_watch_add(child_pid, child_watch_cb, this);
   g_print("spotifyd loaded, pid: %d\n", child_pid);
+  device_seen = false;
+  if (!pending_checks.empty())
+    poll_devices();
   return true;
 }
 
@@ -246,15 +401,278 @@ bool genie::Spotifyd::set_credentials(const std::string &username,
   if (access_token.empty())
     return false;
 
-  if (this->username == username && this->access_token == access_token &&
-      child_pid != -1)
-    return true;
-
+  bool changed =
+      this->username != username || this->access_token != access_token;
   this->username = username;
   this->access_token = access_token;
-  g_debug("setting spotify username %s access token %s", this->username.c_str(),
-          this->access_token.c_str());
-  close();
-  g_usleep(500);
-  return spawn();
+  if (changed) {
+    g_debug("setting spotify username %s access token %s",
+            this->username.c_str(), this->access_token.c_str());
+  }
+  if (!ready)
+    return true;
+
+  if (child_pid != -1) {
+    if (!changed)
+      return true;
+    // restart with the new credentials
+    close();
+    g_usleep(500);
+    return spawn();
+  }
+  if (app->config->audio_spotifyd_idle_s == 0)
+    return spawn();
+  return true;
+}
+
+void genie::Spotifyd::activate() {
+  if (!ready) {
+    g_debug("spotifyd is not ready yet, it will be spawned once it is");
+    pending_activate = true;
+    return;
+  }
+  if (child_pid == -1 && !username.empty() && !access_token.empty())
+    spawn();
+  arm_idle_timer();
+}
+
+void genie::Spotifyd::check(CheckCallback callback) {
+  if (access_token.empty()) {
+    callback(false, "missing Spotify credentials");
+    return;
+  }
+  if (unavailable) {
+    callback(false, "spotifyd is not available");
+    return;
+  }
+
+  activate();
+  if (device_seen) {
+    callback(true, "");
+    return;
+  }
+
+  pending_checks.push_back(std::move(callback));
+  if (!check_timeout_id) {
+    check_timeout_id =
+        g_timeout_add_seconds(CHECK_TIMEOUT_S, on_check_timeout, this);
+  }
+  // otherwise, polling starts once spotifyd is spawned
+  if (child_pid != -1)
+    poll_devices();
+}
+
+/**
+ * @brief Ask Spotify for the devices of the user, to find out when
+ * spotifyd has registered.
+ */
+void genie::Spotifyd::poll_devices() {
+  if (polling_devices || poll_timeout_id)
+    return;
+  polling_devices = true;
+
+  SoupMessage *msg = soup_message_new(
+      "GET", "https://api.spotify.com/v1/me/player/devices");
+  SoupMessageHeaders *headers;
+  g_object_get(msg, "request-headers", &headers, nullptr);
+  char *authorization = g_strdup_printf("Bearer %s", access_token.c_str());
+  soup_message_headers_append(headers, "Authorization", authorization);
+  g_free(authorization);
+
+  soup_session_queue_message(app->get_soup_session(), msg, on_devices, this);
+}
+
+void genie::Spotifyd::on_devices(SoupSession *session, SoupMessage *msg,
+                                 gpointer data) {
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  self->polling_devices = false;
+  if (self->pending_checks.empty())
+    return;
+
+  guint status_code;
+  g_object_get(msg, "status-code", &status_code, nullptr);
+  if (status_code == SOUP_STATUS_UNAUTHORIZED ||
+      status_code == SOUP_STATUS_FORBIDDEN) {
+    g_warning("Spotify rejected the access token: HTTP %u", status_code);
+    self->finish_checks(false, "invalid Spotify credentials");
+    return;
+  }
+
+  bool found = false;
+  if (status_code == SOUP_STATUS_OK) {
+    auto_gobject_ptr<JsonParser> parser(json_parser_new(), adopt_mode::owned);
+    JsonNode *root = nullptr;
+    if (json_parser_load_from_data(parser.get(), msg->response_body->data,
+                                   msg->response_body->length, nullptr))
+      root = json_parser_get_root(parser.get());
+    JsonArray *devices = nullptr;
+    if (root && JSON_NODE_HOLDS_OBJECT(root) &&
+        json_object_has_member(json_node_get_object(root), "devices"))
+      devices = json_object_get_array_member(json_node_get_object(root),
+                                             "devices");
+
+    std::string id = device_id();
+    for (guint i = 0; devices && i < json_array_get_length(devices); i++) {
+      JsonObject *device = json_array_get_object_element(devices, i);
+      if (device && json_object_has_member(device, "id") &&
+          g_strcmp0(json_object_get_string_member(device, "id"),
+                    id.c_str()) == 0) {
+        found = true;
+        break;
+      }
+    }
+  } else {
+    g_debug("Failed to list the Spotify devices: HTTP %u", status_code);
+  }
+
+  // spotifyd may have exited while the request was in flight
+  if (found && self->child_pid != -1) {
+    g_message("spotifyd is registered on Spotify Connect");
+    self->device_seen = true;
+    self->finish_checks(true, "");
+    return;
+  }
+  if (self->child_pid == -1)
+    return;
+
+  self->poll_timeout_id = g_timeout_add(
+      CHECK_POLL_MS,
+      [](gpointer data) {
+        Spotifyd *self = static_cast<Spotifyd *>(data);
+        self->poll_timeout_id = 0;
+        self->poll_devices();
+        return G_SOURCE_REMOVE;
+      },
+      self);
+}
+
+gboolean genie::Spotifyd::on_check_timeout(gpointer data) {
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  self->check_timeout_id = 0;
+  g_warning("spotifyd did not show up on Spotify Connect within %u s",
+            CHECK_TIMEOUT_S);
+  self->finish_checks(false, "spotifyd did not start in time");
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Answer the pending checks, and stop waiting for the device.
+ */
+void genie::Spotifyd::finish_checks(bool ok, const std::string &error) {
+  if (check_timeout_id) {
+    g_source_remove(check_timeout_id);
+    check_timeout_id = 0;
+  }
+  if (poll_timeout_id) {
+    g_source_remove(poll_timeout_id);
+    poll_timeout_id = 0;
+  }
+
+  // callbacks may check again
+  std::vector<CheckCallback> checks;
+  std::swap(checks, pending_checks);
+  for (auto &callback : checks)
+    callback(ok, error);
+}
+
+void genie::Spotifyd::hint(const std::string &command) {
+  if (child_pid != -1 || access_token.empty())
+    return;
+
+  static const char *MUSIC_WORDS[] = {
+      "spotify", "play",      "music",  "song",    "songs",   "playlist",
+      "album",   "playlists", "albums", "artist",  "artists", "resume"};
+  // whole words only, so that "display" or "replay" do not count
+  gchar **words = g_str_tokenize_and_fold(command.c_str(), nullptr, nullptr);
+  bool music = false;
+  for (gchar **word = words; *word && !music; word++) {
+    for (const char *music_word : MUSIC_WORDS) {
+      if (strcmp(*word, music_word) == 0) {
+        music = true;
+        break;
+      }
+    }
+  }
+  g_strfreev(words);
+
+  if (music) {
+    g_message("Command looks like a music request, starting spotifyd ahead");
+    activate();
+  }
+}
+
+void genie::Spotifyd::arm_idle_timer() {
+  size_t idle_s = app->config->audio_spotifyd_idle_s;
+  if (idle_s == 0)
+    return;
+  if (idle_timeout_id)
+    g_source_remove(idle_timeout_id);
+  idle_timeout_id = g_timeout_add_seconds(idle_s, on_idle_timeout, this);
+}
+
+/**
+ * @brief Ask Spotify whether spotifyd is playing, to stop it if not.
+ */
+gboolean genie::Spotifyd::on_idle_timeout(gpointer data) {
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  self->idle_timeout_id = 0;
+  if (self->child_pid == -1)
+    return G_SOURCE_REMOVE;
+
+  SoupMessage *msg =
+      soup_message_new("GET", "https://api.spotify.com/v1/me/player");
+  SoupMessageHeaders *headers;
+  g_object_get(msg, "request-headers", &headers, nullptr);
+  char *authorization =
+      g_strdup_printf("Bearer %s", self->access_token.c_str());
+  soup_message_headers_append(headers, "Authorization", authorization);
+  g_free(authorization);
+
+  soup_session_queue_message(self->app->get_soup_session(), msg,
+                             on_player_state, self);
+  return G_SOURCE_REMOVE;
+}
+
+void genie::Spotifyd::on_player_state(SoupSession *session, SoupMessage *msg,
+                                      gpointer data) {
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  if (self->child_pid == -1 || self->idle_timeout_id)
+    return;
+
+  guint status_code;
+  g_object_get(msg, "status-code", &status_code, nullptr);
+
+  bool playing = false;
+  if (status_code == SOUP_STATUS_OK) {
+    auto_gobject_ptr<JsonParser> parser(json_parser_new(), adopt_mode::owned);
+    JsonNode *root = nullptr;
+    if (json_parser_load_from_data(parser.get(), msg->response_body->data,
+                                   msg->response_body->length, nullptr))
+      root = json_parser_get_root(parser.get());
+    if (root && JSON_NODE_HOLDS_OBJECT(root)) {
+      JsonObject *state = json_node_get_object(root);
+      JsonObject *device = json_object_has_member(state, "device")
+                               ? json_object_get_object_member(state, "device")
+                               : nullptr;
+      const gchar *id = device && json_object_has_member(device, "id")
+                            ? json_object_get_string_member(device, "id")
+                            : nullptr;
+      playing = json_object_has_member(state, "is_playing") &&
+                json_object_get_boolean_member(state, "is_playing") &&
+                g_strcmp0(id, device_id().c_str()) == 0;
+    }
+  } else if (status_code != SOUP_STATUS_NO_CONTENT) {
+    // the token may have expired, keep spotifyd rather than cut the music
+    g_warning("Failed to get the Spotify player state: HTTP %u",
+              status_code);
+    playing = true;
+  }
+
+  if (playing) {
+    self->arm_idle_timer();
+  } else {
+    g_message("spotifyd idle for %zu s, stopping it",
+              self->app->config->audio_spotifyd_idle_s);
+    self->close();
+  }
 }
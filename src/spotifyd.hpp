@@ -19,12 +19,31 @@
 #pragma once
 
 #include "app.hpp"
+#include <functional>
+#include <gio/gio.h>
 #include <string>
+#include <vector>
 
 namespace genie {
 
+/**
+ * @brief Runs spotifyd, the Spotify Connect player, as a child process.
+ *
+ * The spotifyd binary is downloaded to `cache_dir` on first use and when
+ * the required version changes. Provisioning runs in the background, from
+ * `init()`.
+ *
+ * spotifyd is only running while Spotify is in use: it is spawned by
+ * `activate()`, when the server checks or prepares the Spotify player, or
+ * ahead of time by `hint()`, and it is stopped once nothing has played on
+ * it for `audio_spotifyd_idle_s`. With an idle time of 0, it is spawned as
+ * soon as credentials are set and kept running instead.
+ */
 class Spotifyd {
 public:
+  typedef std::function<void(bool ok, const std::string &error)>
+      CheckCallback;
+
   Spotifyd(App *app);
   ~Spotifyd();
   int init();
@@ -33,17 +52,76 @@ public:
   bool set_credentials(const std::string &username,
                        const std::string &access_token);
 
+  /**
+   * @brief Make sure spotifyd is running, because Spotify is about to be
+   * used, and restart the idle timer.
+   */
+  void activate();
+
+  /**
+   * @brief Activate spotifyd, and call `callback` once its device shows up
+   * on Spotify Connect, so that the server can play on it right away.
+   *
+   * `callback` gets an error instead if spotifyd cannot be provisioned, if
+   * there are no credentials, or if the device does not show up within
+   * `CHECK_TIMEOUT_S`.
+   */
+  void check(CheckCallback callback);
+
+  /**
+   * @brief Start spotifyd ahead of `command`, if it looks like a request to
+   * play music, to hide its startup time.
+   */
+  void hint(const std::string &command);
+
 protected:
   int spawn();
-  int download();
-  int check_version();
+  bool is_up_to_date();
+  void download();
+  void download_done(bool success);
+  void arm_idle_timer();
+  void poll_devices();
+  void finish_checks(bool ok, const std::string &error);
+  static void on_devices(SoupSession *session, SoupMessage *msg,
+                         gpointer data);
+  static gboolean on_check_timeout(gpointer data);
+  static gboolean on_idle_timeout(gpointer data);
+  static void on_player_state(SoupSession *session, SoupMessage *msg,
+                              gpointer data);
   static void child_watch_cb(GPid pid, gint status, gpointer data);
+  static void on_killall_done(GObject *source, GAsyncResult *result,
+                              gpointer data);
+  static void on_download_sent(GObject *source, GAsyncResult *result,
+                               gpointer data);
+  static void on_download_spliced(GObject *source, GAsyncResult *result,
+                                  gpointer data);
+  static void on_extract_done(GObject *source, GAsyncResult *result,
+                              gpointer data);
 
 private:
   App *app;
   GPid child_pid;
   std::string username;
   std::string access_token;
+  // the binary is in place, spotifyd can be spawned
+  bool ready;
+  // activate() was called before the binary was ready
+  bool pending_activate;
+  // provisioning failed, and there is no binary to fall back to
+  bool unavailable;
+  guint idle_timeout_id;
+
+  // how long check() waits for the device, including the download
+  static const guint CHECK_TIMEOUT_S = 30;
+  static const guint CHECK_POLL_MS = 500;
+  // the device of the running spotifyd was listed by Spotify
+  bool device_seen;
+  bool polling_devices;
+  guint poll_timeout_id;
+  guint check_timeout_id;
+  std::vector<CheckCallback> pending_checks;
+  auto_gobject_ptr<SoupMessage> download_msg;
+  auto_gobject_ptr<GSubprocess> extract_proc;
 };
 
 } // namespace genie
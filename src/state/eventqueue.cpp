@@ -0,0 +1,113 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "eventqueue.hpp"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::EventQueue"
+
+GSourceFuncs genie::state::EventQueue::source_funcs = {
+    nullptr, nullptr, source_dispatch, nullptr, nullptr, nullptr};
+
+genie::state::EventQueue::EventQueue(gpointer target)
+    : target(target), slots(new Slot[INITIAL_CAPACITY]),
+      capacity(INITIAL_CAPACITY), head(0), count(0) {
+  source = g_source_new(&source_funcs, sizeof(QueueSource));
+  ((QueueSource *)source)->queue = this;
+  // same priority as the idle sources the events used to be dispatched with
+  g_source_set_priority(source, G_PRIORITY_DEFAULT_IDLE);
+  g_source_set_name(source, "genie-events");
+  g_source_attach(source, nullptr);
+}
+
+genie::state::EventQueue::~EventQueue() {
+  g_source_destroy(source);
+  g_source_unref(source);
+
+  for (size_t i = 0; i < count; i++) {
+    Slot &slot = slots[(head + i) % capacity];
+    slot.destroy(&slot);
+  }
+}
+
+/**
+ * @brief Get the slot at the tail of the ring, growing it if it is full.
+ * Must be called with the mutex held.
+ */
+genie::state::EventQueue::Slot &genie::state::EventQueue::next_slot() {
+  if (count == capacity) {
+    std::unique_ptr<Slot[]> grown(new Slot[capacity * 2]);
+    for (size_t i = 0; i < count; i++) {
+      Slot &from = slots[(head + i) % capacity];
+      // copy the handler and ops, then move the event itself
+      grown[i] = from;
+      from.relocate(&grown[i], &from);
+    }
+    slots = std::move(grown);
+    capacity *= 2;
+    head = 0;
+    g_debug("Grew the event queue to %zu slots", capacity);
+  }
+
+  count++;
+  return slots[(head + count - 1) % capacity];
+}
+
+/**
+ * @brief Move the event at the head of the ring into `slot`.
+ */
+bool genie::state::EventQueue::pop(Slot *slot) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (count == 0)
+    return false;
+
+  Slot &front = slots[head];
+  // copy the handler and ops, then move the event itself
+  *slot = front;
+  front.relocate(slot, &front);
+  head = (head + 1) % capacity;
+  count--;
+  return true;
+}
+
+gboolean genie::state::EventQueue::source_dispatch(GSource *source,
+                                                   GSourceFunc callback,
+                                                   gpointer user_data) {
+  EventQueue *self = ((QueueSource *)source)->queue;
+  // pushes from now on wake the source up again
+  g_source_set_ready_time(source, -1);
+
+  size_t batch;
+  {
+    std::lock_guard<std::mutex> lock(self->mutex);
+    batch = self->count;
+  }
+
+  Slot slot;
+  for (size_t i = 0; i < batch && self->pop(&slot); i++) {
+    slot.handler(self->target, slot.get(&slot), slot.t_queued);
+    slot.destroy(&slot);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(self->mutex);
+    if (self->count > 0)
+      g_source_set_ready_time(source, 0);
+  }
+  return G_SOURCE_CONTINUE;
+}
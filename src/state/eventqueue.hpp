@@ -0,0 +1,155 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "events.hpp"
+
+#include <cstddef>
+#include <glib.h>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace genie {
+namespace state {
+
+/**
+ * @brief Queue of the state events dispatched to the main loop, drained by a
+ * single persistent GSource.
+ *
+ * Events are constructed in preallocated slots, inline when they fit, so
+ * dispatching an event usually does not allocate. The slots only grow when
+ * more events are pending than ever before.
+ *
+ * Any thread can push. Events are handled on the main loop in batches: each
+ * time the source dispatches, it handles the events that were queued at that
+ * point. Events pushed by the handlers wait for the next iteration, so a
+ * busy queue does not starve the other sources.
+ */
+class EventQueue {
+public:
+  /**
+   * @brief Called on the main loop with each event, and the monotonic time
+   * at which it was queued. The event is destroyed once the handler returns.
+   */
+  typedef void (*Handler)(gpointer target, events::Event *event,
+                          gint64 t_queued);
+
+  static const size_t INITIAL_CAPACITY = 64;
+  // events up to this size are stored in the slot itself
+  static const size_t INLINE_SIZE = 96;
+
+  EventQueue(gpointer target);
+  ~EventQueue();
+  EventQueue(const EventQueue &) = delete;
+  EventQueue &operator=(const EventQueue &) = delete;
+
+  /**
+   * @brief Queue an event of type `E`, constructed from `args`, to be passed
+   * to `handler` on the main loop. This method is _thread-safe_.
+   */
+  template <typename E, typename... Args>
+  void push(Handler handler, Args &&...args) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Slot &slot = next_slot();
+      slot.handler = handler;
+      slot.t_queued = g_get_monotonic_time();
+      OpsFor<E>::init(&slot, std::forward<Args>(args)...);
+    }
+    // wakes up the main loop, from any thread
+    g_source_set_ready_time(source, 0);
+  }
+
+private:
+  struct Slot {
+    Handler handler;
+    gint64 t_queued;
+    events::Event *(*get)(Slot *slot);
+    // move-constructs the event into `to`, and destroys it in `from`
+    void (*relocate)(Slot *to, Slot *from);
+    void (*destroy)(Slot *slot);
+    alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+  };
+
+  template <typename E> struct InlineOps {
+    static E *ptr(Slot *slot) { return reinterpret_cast<E *>(slot->storage); }
+
+    template <typename... Args> static void init(Slot *slot, Args &&...args) {
+      new (slot->storage) E(std::forward<Args>(args)...);
+      slot->get = get;
+      slot->relocate = relocate;
+      slot->destroy = destroy;
+    }
+    static events::Event *get(Slot *slot) { return ptr(slot); }
+    static void relocate(Slot *to, Slot *from) {
+      new (to->storage) E(std::move(*ptr(from)));
+      ptr(from)->~E();
+    }
+    static void destroy(Slot *slot) { ptr(slot)->~E(); }
+  };
+
+  template <typename E> struct BoxedOps {
+    static E *&ptr(Slot *slot) {
+      return *reinterpret_cast<E **>(slot->storage);
+    }
+
+    template <typename... Args> static void init(Slot *slot, Args &&...args) {
+      ptr(slot) = new E(std::forward<Args>(args)...);
+      slot->get = get;
+      slot->relocate = relocate;
+      slot->destroy = destroy;
+    }
+    static events::Event *get(Slot *slot) { return ptr(slot); }
+    static void relocate(Slot *to, Slot *from) { ptr(to) = ptr(from); }
+    static void destroy(Slot *slot) { delete ptr(slot); }
+  };
+
+  template <typename E>
+  using OpsFor = typename std::conditional<
+      sizeof(E) <= INLINE_SIZE && alignof(E) <= alignof(std::max_align_t),
+      InlineOps<E>, BoxedOps<E>>::type;
+
+  struct QueueSource {
+    GSource source;
+    EventQueue *queue;
+  };
+
+  const gpointer target;
+  GSource *source;
+
+  // ring buffer of `capacity` slots, `count` of them in use from `head`
+  std::mutex mutex;
+  std::unique_ptr<Slot[]> slots;
+  size_t capacity;
+  size_t head;
+  size_t count;
+
+  Slot &next_slot();
+  bool pop(Slot *slot);
+
+  static gboolean source_dispatch(GSource *source, GSourceFunc callback,
+                                  gpointer user_data);
+  static GSourceFuncs source_funcs;
+};
+
+} // namespace state
+} // namespace genie
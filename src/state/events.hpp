@@ -61,6 +61,11 @@ template <typename Value> struct RequestEvent : public Event {
     request->reject(error_code, error_message);
   }
 
+  /**
+   * @brief Take over the request, to answer it after the event is handled.
+   */
+  std::unique_ptr<Request<Value>> take_request() { return std::move(request); }
+
 private:
   std::unique_ptr<Request<Value>> request;
 };
@@ -92,8 +97,11 @@ struct InputFrame : Event {
 
 struct InputDone : Event {
   bool vad_detected;
+  // listening stopped after `vad_listen_timeout_ms`, before the end of speech
+  bool timed_out;
 
-  InputDone(bool vad_detected) : vad_detected(vad_detected) {}
+  InputDone(bool vad_detected, bool timed_out = false)
+      : vad_detected(vad_detected), timed_out(timed_out) {}
 };
 
 struct InputNotDetected : Event {};
@@ -138,10 +146,13 @@ struct AskSpecialMessage : Event {
 struct SpotifyCredentials : Event {
   std::string access_token;
   std::string username;
+  // Spotify is about to be used, spotifyd must be started
+  bool activate;
 
-  SpotifyCredentials(const gchar *username, const gchar *access_token)
+  SpotifyCredentials(const gchar *username, const gchar *access_token,
+                     bool activate = false)
       : access_token(access_token == nullptr ? "" : access_token),
-        username(username == nullptr ? "" : username) {}
+        username(username == nullptr ? "" : username), activate(activate) {}
 };
 
 // Button Events
@@ -167,9 +178,11 @@ struct ToggleConfigMode : Event {};
 struct PlayerStreamEnter : Event {
   AudioTaskType type;
   gint64 ref_id;
+  // monotonic time at which the first sample left the sink, in microseconds
+  gint64 t_audible;
 
-  PlayerStreamEnter(AudioTaskType type, gint64 ref_id)
-      : type(type), ref_id(ref_id) {}
+  PlayerStreamEnter(AudioTaskType type, gint64 ref_id, gint64 t_audible)
+      : type(type), ref_id(ref_id), t_audible(t_audible) {}
 };
 
 struct PlayerStreamEnd : Event {
@@ -226,6 +239,16 @@ struct StopEvent : public RequestEvent<void> {
       : RequestEvent<void>(std::move(req)) {}
 };
 
+struct PauseEvent : public RequestEvent<void> {
+  PauseEvent(std::unique_ptr<Request<void>> &&req)
+      : RequestEvent<void>(std::move(req)) {}
+};
+
+struct ResumeEvent : public RequestEvent<void> {
+  ResumeEvent(std::unique_ptr<Request<void>> &&req)
+      : RequestEvent<void>(std::move(req)) {}
+};
+
 struct PlayURLsEvent : public RequestEvent<void> {
   PlayURLsEvent(std::unique_ptr<Request<void>> &&req,
                 std::vector<std::string> urls)
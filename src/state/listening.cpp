@@ -33,6 +33,7 @@ namespace state {
 void Listening::enter() {
   State::enter();
 
+  app->tracer->begin_turn();
   app->leds->animate(LedsState_t::Listening);
   app->stt->begin_session(is_follow_up);
   app->audio_input->wake();
@@ -61,6 +62,10 @@ void Listening::react(events::InputDone *input_done) {
   if (input_done->vad_detected) {
     app->audio_player->play_sound(Sound_t::WORKING);
   }
+  if (!input_done->vad_detected)
+    app->recorder->dump("false-wake");
+  else if (input_done->timed_out)
+    app->recorder->dump("listen-timeout");
   app->transit(new Processing(app));
 }
 
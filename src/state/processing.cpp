@@ -20,6 +20,7 @@
 #include "app.hpp"
 #include "audio/audioplayer.hpp"
 #include "leds.hpp"
+#include "spotifyd.hpp"
 #include "ws-protocol/client.hpp"
 
 #undef G_LOG_DOMAIN
@@ -51,6 +52,7 @@ void Processing::react(events::TextMessage *text_message) {
 void Processing::react(events::stt::TextResponse *response) {
   app->track_processing_event(ProcessingEventType::END_STT);
   app->audio_player.get()->clean_queue();
+  app->spotifyd->hint(response->text);
   app->track_processing_event(ProcessingEventType::START_GENIE);
   app->conversation_client.get()->send_command(response->text);
 }
@@ -59,6 +61,7 @@ void Processing::react(events::stt::ErrorResponse *response) {
   app->track_processing_event(ProcessingEventType::END_STT);
   g_warning("STT completed with an error (code=%d): %s", response->code,
             response->message.c_str());
+  app->recorder->dump("stt-error");
   if (response->code != 404) {
     app->audio_player.get()->play_sound(Sound_t::STT_ERROR);
     app->leds->animate(LedsState_t::Error);
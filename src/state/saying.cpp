@@ -50,7 +50,8 @@ void Saying::react(events::AskSpecialMessage *ask_special_message) {
 
 void Saying::react(events::PlayerStreamEnter *player_stream_enter) {
   if (player_stream_enter->ref_id == text_id) {
-    app->track_processing_event(ProcessingEventType::END_TTS);
+    app->track_processing_event(ProcessingEventType::END_TTS,
+                                player_stream_enter->t_audible);
   }
 }
 
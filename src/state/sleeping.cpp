@@ -30,6 +30,8 @@ namespace state {
 
 void Sleeping::enter() {
   State::enter();
+  // a turn that ended early (no speech, STT or Genie error) is still traced
+  app->tracer->end_turn();
   app->audio_volume_controller->unduck();
   app->leds->animate(LedsState_t::Sleeping);
 }
@@ -44,8 +46,7 @@ void Sleeping::react(events::audio::PlayURLsEvent *play_urls) {
 
   app->audio_player->clean_queue();
 
-  for (const auto &url : play_urls->urls)
-    app->audio_player->play_url(url);
+  app->audio_player->play_urls(play_urls->urls);
 
   play_urls->resolve();
 }
@@ -106,6 +106,8 @@ void State::react(events::AskSpecialMessage *ask_special_message) {}
 void State::react(events::SpotifyCredentials *spotify_credentials) {
   app->spotifyd->set_credentials(spotify_credentials->username,
                                  spotify_credentials->access_token);
+  if (spotify_credentials->activate)
+    app->spotifyd->activate();
 }
 
 void State::react(events::AdjustVolume *adjust_volume) {
@@ -163,7 +165,12 @@ void State::react(events::stt::ErrorResponse *response) {
 void State::react(events::audio::CheckSpotifyEvent *check_spotify) {
   app->spotifyd->set_credentials(check_spotify->username,
                                  check_spotify->access_token);
-  check_spotify->resolve(std::make_pair(true, ""));
+  // answered once spotifyd is ready to play
+  std::shared_ptr<events::Request<events::audio::CheckResponse>> request =
+      check_spotify->take_request();
+  app->spotifyd->check([request](bool ok, const std::string &error) {
+    request->resolve(std::make_pair(ok, error));
+  });
 }
 
 void State::react(events::audio::PrepareEvent *prepare) {
@@ -174,6 +181,9 @@ void State::react(events::audio::PrepareEvent *prepare) {
 void State::react(events::audio::PlayURLsEvent *play_urls) {
   g_message("Reacting to PlayURLsEvent in %s state, deferring", NAME);
 
+  // start buffering now, so it plays right away once it is replayed
+  app->audio_player->preroll_urls(play_urls->urls);
+
   // defer this event to the next state
   app->defer(play_urls);
 }
@@ -183,6 +193,17 @@ void State::react(events::audio::StopEvent *stop) {
   stop->resolve();
 }
 
+void State::react(events::audio::PauseEvent *pause) {
+  app->audio_player->pause();
+  pause->resolve();
+}
+
+void State::react(events::audio::ResumeEvent *resume) {
+  // spotify resumes on its own, this is for news and radio
+  app->audio_player->resume();
+  resume->resolve();
+}
+
 void State::react(events::audio::SetMuteEvent *set_mute) {
   // TODO implement
   set_mute->resolve();
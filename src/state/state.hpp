@@ -71,6 +71,8 @@ public:
   virtual void react(events::audio::PrepareEvent *prepare);
   virtual void react(events::audio::PlayURLsEvent *play_urls);
   virtual void react(events::audio::StopEvent *stop);
+  virtual void react(events::audio::PauseEvent *pause);
+  virtual void react(events::audio::ResumeEvent *resume);
   virtual void react(events::audio::SetMuteEvent *set_mute);
   virtual void react(events::audio::SetVolumeEvent *set_volume);
   virtual void react(events::audio::AdjVolumeEvent *adj_volume);
@@ -0,0 +1,109 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <glib.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::Stats"
+
+genie::StatsSeries::StatsSeries() : next(0), total_count(0), last_value(0) {
+  samples.reserve(WINDOW_SIZE);
+}
+
+void genie::StatsSeries::record(double value) {
+  if (samples.size() < WINDOW_SIZE) {
+    samples.push_back(value);
+  } else {
+    samples[next] = value;
+  }
+  next = (next + 1) % WINDOW_SIZE;
+  total_count += 1;
+  last_value = value;
+}
+
+double genie::StatsSeries::percentile(double p) const {
+  if (samples.empty())
+    return 0;
+
+  std::vector<double> sorted(samples);
+  // nearest-rank percentile
+  size_t rank = (size_t)std::ceil(p / 100 * sorted.size());
+  size_t index = rank > 0 ? std::min(rank - 1, sorted.size() - 1) : 0;
+  std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+  return sorted[index];
+}
+
+double genie::StatsSeries::mean() const {
+  if (samples.empty())
+    return 0;
+
+  double sum = 0;
+  for (double value : samples)
+    sum += value;
+  return sum / samples.size();
+}
+
+void genie::Stats::record(const char *name, double value) {
+  series[name].record(value);
+}
+
+void genie::Stats::log_summary(const char *name) {
+  auto it = series.find(name);
+  if (it == series.end())
+    return;
+
+  const StatsSeries &s = it->second;
+  g_message("%s: last %.1f, p50 %.1f, p95 %.1f, p99 %.1f (n=%zu)", name,
+            s.last(), s.percentile(50), s.percentile(95), s.percentile(99),
+            s.count());
+}
+
+double genie::Stats::mean(const char *name) {
+  auto it = series.find(name);
+  if (it == series.end())
+    return 0;
+  return it->second.mean();
+}
+
+void genie::Stats::to_json(JsonBuilder *builder) {
+  for (const auto &it : series) {
+    const StatsSeries &s = it.second;
+
+    json_builder_set_member_name(builder, it.first.c_str());
+    json_builder_begin_object(builder);
+
+    json_builder_set_member_name(builder, "count");
+    json_builder_add_int_value(builder, s.count());
+    json_builder_set_member_name(builder, "last");
+    json_builder_add_double_value(builder, s.last());
+    json_builder_set_member_name(builder, "mean");
+    json_builder_add_double_value(builder, s.mean());
+    json_builder_set_member_name(builder, "p50");
+    json_builder_add_double_value(builder, s.percentile(50));
+    json_builder_set_member_name(builder, "p95");
+    json_builder_add_double_value(builder, s.percentile(95));
+    json_builder_set_member_name(builder, "p99");
+    json_builder_add_double_value(builder, s.percentile(99));
+
+    json_builder_end_object(builder);
+  }
+}
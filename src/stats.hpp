@@ -0,0 +1,97 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <json-glib/json-glib.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace genie {
+
+/**
+ * @brief A rolling window over the most recent samples of one measurement,
+ * such as a latency in milliseconds.
+ */
+class StatsSeries {
+public:
+  static const size_t WINDOW_SIZE = 256;
+
+  StatsSeries();
+
+  void record(double value);
+
+  /**
+   * @brief Compute the `p`-th percentile (0 to 100) over the samples
+   * currently in the window.
+   */
+  double percentile(double p) const;
+
+  /**
+   * @brief Compute the mean of the samples currently in the window. For a
+   * series of 0/1 samples, this is the rate of 1s.
+   */
+  double mean() const;
+
+  /**
+   * @brief Total number of samples recorded, including those that have
+   * already left the window.
+   */
+  size_t count() const { return total_count; }
+  double last() const { return last_value; }
+
+private:
+  std::vector<double> samples;
+  size_t next;
+  size_t total_count;
+  double last_value;
+};
+
+/**
+ * @brief Named rolling statistics collected across the application, exposed
+ * in the logs and on the `/stats` page of the Web UI.
+ *
+ * Not thread-safe, must only be used from the main thread.
+ */
+class Stats {
+public:
+  void record(const char *name, double value);
+
+  /**
+   * @brief Log a one-line p50/p95/p99 summary of the series `name`.
+   */
+  void log_summary(const char *name);
+
+  /**
+   * @brief Mean of the window of the series `name`, or 0 if nothing was
+   * recorded.
+   */
+  double mean(const char *name);
+
+  /**
+   * @brief Add all series to `builder`, as an object member per series.
+   * Must be called while building an object.
+   */
+  void to_json(JsonBuilder *builder);
+
+private:
+  std::map<std::string, StatsSeries> series;
+};
+
+} // namespace genie
@@ -17,6 +17,8 @@
 // limitations under the License.
 
 #include "stt.hpp"
+#include "metrics.hpp"
+#include "stats.hpp"
 
 #include <cstring>
 #include <glib-object.h>
@@ -52,18 +54,20 @@ genie::STT::STT(App *app) : m_app(app), m_url(get_ws_url(app)) {
 void genie::STT::complete_success(STTSession *session, const char *text) {
   if (session != m_current_session.get())
     return;
+  report_timing(session, true);
   m_current_session = nullptr;
 
-  m_app->dispatch(new TextResponse(text));
+  m_app->dispatch<TextResponse>(text);
 }
 
 void genie::STT::complete_error(STTSession *session, int error_code,
                                 const char *error_message) {
   if (session != m_current_session.get())
     return;
+  report_timing(session, false);
   m_current_session = nullptr;
 
-  m_app->dispatch(new ErrorResponse(error_code, error_message));
+  m_app->dispatch<ErrorResponse>(error_code, error_message);
 }
 
 void genie::STT::begin_session(bool is_follow_up) {
@@ -105,36 +109,151 @@ void genie::STT::send_frame(AudioFrame frame) {
 
 void genie::STT::record_timing_event(STTSession *session,
                                      genie::STT::Event event) {
-  if (session != m_current_session.get())
-    return;
+  auto now = std::chrono::steady_clock::now();
+  STTSession::Timing &timing = session->m_timing;
 
   switch (event) {
-    case genie::STT::Event::DONE:
-      gettimeofday(&tDone, NULL);
+    case genie::STT::Event::CONNECT:
+      // on retries, this is overwritten with the start of the last attempt
+      timing.connect = now;
       break;
 
-    case genie::STT::Event::CONNECT:
-      gettimeofday(&tConnect, NULL);
+    case genie::STT::Event::HANDSHAKE:
+      timing.handshake = now;
       break;
 
     case genie::STT::Event::FIRST_FRAME:
-      gettimeofday(&tFirstFrame, NULL);
+      timing.first_frame = now;
       break;
 
     case genie::STT::Event::LAST_FRAME:
-      gettimeofday(&tLastFrame, NULL);
+      timing.last_frame = now;
       break;
 
-    default:
-      // TODO
+    case genie::STT::Event::DONE:
+      timing.done = now;
       break;
   }
 }
 
+static double elapsed_ms(std::chrono::steady_clock::time_point from,
+                         std::chrono::steady_clock::time_point to) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+// steady_clock and g_get_monotonic_time() both read CLOCK_MONOTONIC
+static gint64 monotonic_us(std::chrono::steady_clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+/**
+ * @brief Add the phases of a completed session to the trace of the turn.
+ */
+static void trace_timing(genie::Tracer *tracer,
+                         const genie::STTSession::Timing &timing) {
+  if (!tracer->enabled())
+    return;
+
+  const std::chrono::steady_clock::time_point never;
+  if (timing.handshake != never) {
+    tracer->span("stt.connect", monotonic_us(timing.begin),
+                 monotonic_us(timing.handshake));
+    tracer->span("stt.handshake", monotonic_us(timing.connect),
+                 monotonic_us(timing.handshake));
+  }
+  if (timing.first_frame != never && timing.last_frame != never) {
+    tracer->span("stt.stream", monotonic_us(timing.first_frame),
+                 monotonic_us(timing.last_frame));
+  }
+  if (timing.last_frame != never && timing.done != never) {
+    tracer->span("stt.result", monotonic_us(timing.last_frame),
+                 monotonic_us(timing.done));
+  }
+}
+
+/**
+ * @brief Log the timing record of a completed session and add it to the
+ * rolling statistics.
+ *
+ * - `connect_ms`: from the start of the session to the websocket being open,
+ *   including retries
+ * - `handshake_ms`: duration of the successful connection attempt (TCP, TLS
+ *   and websocket upgrade)
+ * - `first_frame_ms`: from the start of the session to the first audio frame
+ *   going out
+ * - `last_frame_ms`: from the start of the session to the end of speech
+ *   being sent
+ * - `result_ms`: from the end of speech to the result coming back
+ */
+void genie::STT::report_timing(STTSession *session, bool success) {
+  const STTSession::Timing &timing = session->timing();
+  const std::chrono::steady_clock::time_point never;
+  Stats *stats = m_app->stats.get();
+
+  double audio_s = (double)timing.samples_sent / SAMPLE_RATE;
+  stats->record("stt.audio_s", audio_s);
+  stats->record("stt.bytes", timing.bytes_sent);
+
+  double connect_ms = -1, handshake_ms = -1, first_frame_ms = -1,
+         last_frame_ms = -1, result_ms = -1;
+  if (timing.handshake != never) {
+    connect_ms = elapsed_ms(timing.begin, timing.handshake);
+    handshake_ms = elapsed_ms(timing.connect, timing.handshake);
+    stats->record("stt.connect_ms", connect_ms);
+    stats->record("stt.handshake_ms", handshake_ms);
+  }
+  if (timing.first_frame != never) {
+    first_frame_ms = elapsed_ms(timing.begin, timing.first_frame);
+    stats->record("stt.first_frame_ms", first_frame_ms);
+  }
+  if (timing.last_frame != never) {
+    last_frame_ms = elapsed_ms(timing.begin, timing.last_frame);
+    stats->record("stt.last_frame_ms", last_frame_ms);
+  }
+  if (success && timing.last_frame != never && timing.done != never) {
+    result_ms = elapsed_ms(timing.last_frame, timing.done);
+    stats->record("stt.result_ms", result_ms);
+  }
+
+  g_message("STT session %s: connect %.1f ms, handshake %.1f ms, first frame "
+            "%.1f ms, last frame %.1f ms, result %.1f ms, sent %.2f s of "
+            "audio (%zu bytes)",
+            success ? "done" : "failed", connect_ms, handshake_ms,
+            first_frame_ms, last_frame_ms, result_ms, audio_s,
+            timing.bytes_sent);
+  stats->log_summary("stt.connect_ms");
+  stats->log_summary("stt.result_ms");
+
+  Metrics *metrics = m_app->metrics.get();
+  metrics
+      ->counter("genie_stt_sessions_total", "STT sessions, by outcome.",
+                success ? "result=\"done\"" : "result=\"failed\"")
+      ->inc();
+  if (connect_ms >= 0) {
+    metrics
+        ->histogram("genie_stt_connect_seconds",
+                    "Time to open the STT websocket, including retries, in "
+                    "seconds.")
+        ->observe(connect_ms / 1000);
+  }
+  if (result_ms >= 0) {
+    metrics
+        ->histogram("genie_stt_result_seconds",
+                    "Time from the end of speech to the STT result, in "
+                    "seconds.")
+        ->observe(result_ms / 1000);
+  }
+
+  trace_timing(m_app->tracer.get(), timing);
+}
+
 genie::STTSession::STTSession(STT *controller, const char *url,
                               bool is_follow_up)
     : m_controller(controller), m_state(State::INITIAL), m_done(false),
       is_follow_up(is_follow_up), m_url(url), retries(0) {
+  m_timing.begin = std::chrono::steady_clock::now();
   connect();
 }
 
@@ -149,6 +268,7 @@ genie::STTSession::~STTSession() {
 
 void genie::STTSession::connect() {
   g_debug("STT connecting...\n");
+  m_controller->record_timing_event(this, STT::Event::CONNECT);
 
   auto_gobject_ptr<SoupMessage> msg(soup_message_new(SOUP_METHOD_GET, m_url),
                                     adopt_mode::owned);
@@ -164,9 +284,6 @@ void genie::STTSession::on_connection(SoupSession *session, GAsyncResult *res,
                                       gpointer data) {
   STTSession *self = static_cast<STTSession *>(data);
 
-  g_debug("STT connected");
-  self->m_controller->record_timing_event(self, STT::Event::FIRST_FRAME);
-
   GError *error = NULL;
   self->m_connection = auto_gobject_ptr<SoupWebsocketConnection>(
       soup_session_websocket_connect_finish(session, res, &error),
@@ -185,6 +302,8 @@ void genie::STTSession::on_connection(SoupSession *session, GAsyncResult *res,
     }
     return;
   }
+  g_debug("STT connected");
+  self->m_controller->record_timing_event(self, STT::Event::HANDSHAKE);
   self->m_state = State::STREAMING;
 
   soup_websocket_connection_send_text(self->m_connection.get(),
@@ -343,5 +462,9 @@ void genie::STTSession::dispatch_frame(AudioFrame frame) {
                                         frame.length * sizeof(int16_t));
   if (frame.length == 0) {
     m_controller->record_timing_event(this, STT::Event::LAST_FRAME);
+  } else if (m_timing.samples_sent == 0) {
+    m_controller->record_timing_event(this, STT::Event::FIRST_FRAME);
   }
+  m_timing.samples_sent += frame.length;
+  m_timing.bytes_sent += frame.length * sizeof(int16_t);
 }
@@ -23,6 +23,7 @@
 
 #include "app.hpp"
 #include "utils/autoptrs.hpp"
+#include <chrono>
 #include <queue>
 #include <regex>
 
@@ -31,6 +32,8 @@ namespace genie {
 class STT;
 
 class STTSession {
+  friend class STT;
+
 public:
   enum class State {
     INITIAL,
@@ -40,10 +43,29 @@ public:
     CLOSED,
   };
 
+  /**
+   * @brief Timing of a single session, on the monotonic clock.
+   *
+   * Time points that were never reached are left at their default (epoch)
+   * value.
+   */
+  struct Timing {
+    std::chrono::steady_clock::time_point begin;
+    std::chrono::steady_clock::time_point connect;
+    std::chrono::steady_clock::time_point handshake;
+    std::chrono::steady_clock::time_point first_frame;
+    std::chrono::steady_clock::time_point last_frame;
+    std::chrono::steady_clock::time_point done;
+
+    size_t samples_sent = 0;
+    size_t bytes_sent = 0;
+  };
+
 private:
   STT *const m_controller;
 
   State m_state;
+  Timing m_timing;
   std::queue<AudioFrame> queue;
   auto_gobject_ptr<SoupWebsocketConnection> m_connection;
   bool m_done;
@@ -65,6 +87,7 @@ public:
   static void on_close(SoupWebsocketConnection *conn, gpointer data);
 
   State state() const { return m_state; }
+  const Timing &timing() const { return m_timing; }
 
   void flush_queue();
   void dispatch_frame(AudioFrame frame);
@@ -85,9 +108,15 @@ public:
   void send_done();
   void abort();
 
+  /**
+   * The STT protocol streams 16 kHz mono 16-bit PCM.
+   */
+  static const size_t SAMPLE_RATE = 16000;
+
 private:
   enum class Event {
     CONNECT,
+    HANDSHAKE,
     FIRST_FRAME,
     LAST_FRAME,
     DONE,
@@ -97,17 +126,13 @@ private:
   void complete_error(STTSession *session, int error_code,
                       const char *error_message);
   void record_timing_event(STTSession *session, Event ev);
+  void report_timing(STTSession *session, bool success);
 
   App *const m_app;
   const std::string m_url;
   std::unique_ptr<STTSession> m_current_session;
 
   std::regex wake_word_pattern;
-
-  struct timeval tConnect;
-  struct timeval tFirstFrame;
-  struct timeval tLastFrame;
-  struct timeval tDone;
 };
 
 } // namespace genie
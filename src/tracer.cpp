@@ -0,0 +1,241 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tracer.hpp"
+#include "utils/autoptrs.hpp"
+
+#include <algorithm>
+#include <errno.h>
+#include <json-glib/json-glib.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::Tracer"
+
+static const char *TRACE_PREFIX = "turn-";
+static const char *TRACE_SUFFIX = ".json";
+
+static pid_t current_tid() {
+  static thread_local pid_t tid = 0;
+  if (!tid)
+    tid = (pid_t)syscall(SYS_gettid);
+  return tid;
+}
+
+genie::Tracer::Tracer() : is_enabled(false), max_files(0) {}
+
+genie::Tracer::Tracer(const char *dir, size_t max_files)
+    : is_enabled(true), dir(dir), max_files(max_files) {
+  if (g_mkdir_with_parents(dir, 0755) < 0) {
+    g_warning("Failed to create trace directory %s: %s", dir,
+              strerror(errno));
+  }
+  g_message("Tracing turns to %s, keeping %zu files", dir, max_files);
+}
+
+void genie::Tracer::record(char phase, const char *name, gint64 ts,
+                           gint64 t_end) {
+  pid_t tid = current_tid();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!thread_names.count(tid)) {
+    char thread_name[16] = "";
+    pthread_getname_np(pthread_self(), thread_name, sizeof(thread_name));
+    thread_names[tid] = thread_name;
+  }
+
+  events.push_back(TraceEvent{phase, name, ts, t_end - ts, tid});
+  if (events.size() > MAX_EVENTS)
+    events.pop_front();
+}
+
+void genie::Tracer::begin_turn() {
+  if (!is_enabled)
+    return;
+  t_turn = g_get_monotonic_time();
+  instant("turn");
+}
+
+void genie::Tracer::end_turn() {
+  if (!is_enabled || !t_turn)
+    return;
+
+  gint64 t_from = t_turn - TURN_LEAD_US;
+  t_turn = 0;
+  GBytes *trace = build_trace(t_from);
+
+  prune();
+
+  GDateTime *now = g_date_time_new_now_local();
+  gchar *stamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+  gchar *name = g_strdup_printf("%s%s-%03d%s", TRACE_PREFIX, stamp,
+                                g_date_time_get_microsecond(now) / 1000,
+                                TRACE_SUFFIX);
+  gchar *path = g_build_filename(dir.c_str(), name, nullptr);
+  g_date_time_unref(now);
+  g_free(stamp);
+  g_free(name);
+
+  g_debug("Writing turn trace to %s (%zu bytes)", path,
+          g_bytes_get_size(trace));
+  GFile *file = g_file_new_for_path(path);
+  g_file_replace_contents_bytes_async(file, trace, nullptr, false,
+                                      G_FILE_CREATE_NONE, nullptr,
+                                      on_write_done, path);
+  g_object_unref(file);
+  g_bytes_unref(trace);
+}
+
+void genie::Tracer::on_write_done(GObject *source, GAsyncResult *result,
+                                  gpointer data) {
+  gchar *path = static_cast<gchar *>(data);
+  GError *error = nullptr;
+  if (!g_file_replace_contents_finish(G_FILE(source), result, nullptr,
+                                      &error)) {
+    g_warning("Failed to write trace %s: %s", path, error->message);
+    g_error_free(error);
+  } else {
+    g_message("Wrote turn trace %s", path);
+  }
+  g_free(path);
+}
+
+static void add_thread_name(JsonBuilder *builder, pid_t pid, pid_t tid,
+                            const std::string &name) {
+  json_builder_begin_object(builder);
+  json_builder_set_member_name(builder, "name");
+  json_builder_add_string_value(builder, "thread_name");
+  json_builder_set_member_name(builder, "ph");
+  json_builder_add_string_value(builder, "M");
+  json_builder_set_member_name(builder, "pid");
+  json_builder_add_int_value(builder, pid);
+  json_builder_set_member_name(builder, "tid");
+  json_builder_add_int_value(builder, tid);
+  json_builder_set_member_name(builder, "args");
+  json_builder_begin_object(builder);
+  json_builder_set_member_name(builder, "name");
+  json_builder_add_string_value(builder, name.c_str());
+  json_builder_end_object(builder);
+  json_builder_end_object(builder);
+}
+
+/**
+ * @brief Serialize the events since `t_from` in the Chrome trace event format.
+ *
+ * Spans are complete events (`X`), instants are thread-scoped `i` events,
+ * and the thread names are `M` metadata events. Timestamps are relative to
+ * `t_from`, so the trace starts at 0.
+ */
+GBytes *genie::Tracer::build_trace(gint64 t_from) {
+  std::vector<TraceEvent> turn_events;
+  std::map<pid_t, std::string> names;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const TraceEvent &event : events) {
+      if (event.ts + event.dur >= t_from)
+        turn_events.push_back(event);
+    }
+    names = thread_names;
+  }
+
+  pid_t pid = getpid();
+  auto_gobject_ptr<JsonBuilder> builder(json_builder_new(), adopt_mode::owned);
+  JsonBuilder *b = builder.get();
+  json_builder_begin_object(b);
+  json_builder_set_member_name(b, "displayTimeUnit");
+  json_builder_add_string_value(b, "ms");
+  json_builder_set_member_name(b, "traceEvents");
+  json_builder_begin_array(b);
+
+  for (const auto &it : names)
+    add_thread_name(b, pid, it.first, it.second);
+
+  for (const TraceEvent &event : turn_events) {
+    const char phase[] = {event.phase, '\0'};
+    json_builder_begin_object(b);
+    json_builder_set_member_name(b, "name");
+    json_builder_add_string_value(b, event.name);
+    json_builder_set_member_name(b, "cat");
+    json_builder_add_string_value(b, "genie");
+    json_builder_set_member_name(b, "ph");
+    json_builder_add_string_value(b, phase);
+    json_builder_set_member_name(b, "ts");
+    json_builder_add_int_value(b, event.ts - t_from);
+    if (event.phase == 'X') {
+      json_builder_set_member_name(b, "dur");
+      json_builder_add_int_value(b, event.dur);
+    } else {
+      json_builder_set_member_name(b, "s");
+      json_builder_add_string_value(b, "t");
+    }
+    json_builder_set_member_name(b, "pid");
+    json_builder_add_int_value(b, pid);
+    json_builder_set_member_name(b, "tid");
+    json_builder_add_int_value(b, event.tid);
+    json_builder_end_object(b);
+  }
+
+  json_builder_end_array(b);
+  json_builder_end_object(b);
+
+  auto_gobject_ptr<JsonGenerator> gen(json_generator_new(), adopt_mode::owned);
+  JsonNode *root = json_builder_get_root(b);
+  json_generator_set_root(gen.get(), root);
+  json_node_unref(root);
+  gsize length;
+  gchar *json = json_generator_to_data(gen.get(), &length);
+
+  return g_bytes_new_take(json, length);
+}
+
+/**
+ * @brief Remove the oldest traces, leaving room for a new one.
+ *
+ * The file names start with the time of the turn, so they sort by age.
+ */
+void genie::Tracer::prune() {
+  GError *error = nullptr;
+  GDir *gdir = g_dir_open(dir.c_str(), 0, &error);
+  if (!gdir) {
+    g_warning("Failed to read trace directory: %s", error->message);
+    g_error_free(error);
+    return;
+  }
+
+  std::vector<std::string> traces;
+  const char *name;
+  while ((name = g_dir_read_name(gdir))) {
+    if (g_str_has_prefix(name, TRACE_PREFIX) &&
+        g_str_has_suffix(name, TRACE_SUFFIX))
+      traces.push_back(name);
+  }
+  g_dir_close(gdir);
+
+  if (traces.size() < max_files)
+    return;
+  std::sort(traces.begin(), traces.end());
+  size_t excess = traces.size() - max_files + 1;
+  for (size_t i = 0; i < excess; i++) {
+    g_debug("Removing trace %s", traces[i].c_str());
+    unlink((dir + "/" + traces[i]).c_str());
+  }
+}
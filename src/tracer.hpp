@@ -0,0 +1,151 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <deque>
+#include <gio/gio.h>
+#include <glib.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+
+namespace genie {
+
+/**
+ * @brief Records timed spans across the threads of the app, and writes each
+ * turn out as a Chrome trace (JSON), to be opened in Perfetto or
+ * chrome://tracing.
+ *
+ * Times are on the monotonic clock, in microseconds, like
+ * `g_get_monotonic_time()`. Span and instant names are not copied, they
+ * must outlive the tracer (string literals, usually).
+ *
+ * Recording is _thread-safe_. A disabled tracer returns right away from every
+ * call, so call sites do not need to check `enabled()` unless they compute
+ * something for the trace only.
+ */
+class Tracer {
+public:
+  // events kept in memory, the oldest are dropped first
+  static const size_t MAX_EVENTS = 8192;
+  // a turn is exported from this long before it began, to include the
+  // wake-word detection
+  static const gint64 TURN_LEAD_US = 1000000;
+
+  /**
+   * @brief Construct a disabled tracer.
+   */
+  Tracer();
+
+  /**
+   * @brief Construct a tracer that writes turns to `dir`, keeping the
+   * `max_files` most recent.
+   */
+  Tracer(const char *dir, size_t max_files);
+
+  bool enabled() const { return is_enabled; }
+
+  /**
+   * @brief The current time for a span start, or 0 if disabled.
+   */
+  gint64 now() const { return is_enabled ? g_get_monotonic_time() : 0; }
+
+  /**
+   * @brief Record the span `name` on the calling thread, from `t_start` to
+   * `t_end`, or to now if `t_end` is 0.
+   */
+  void span(const char *name, gint64 t_start, gint64 t_end = 0) {
+    if (is_enabled)
+      record('X', name, t_start, t_end ? t_end : g_get_monotonic_time());
+  }
+
+  /**
+   * @brief Record the instant `name` on the calling thread, at `t`, or now
+   * if `t` is 0.
+   */
+  void instant(const char *name, gint64 t = 0) {
+    if (is_enabled)
+      record('i', name, t ? t : g_get_monotonic_time(), 0);
+  }
+
+  /**
+   * @brief Mark the start of a turn. Main thread only.
+   */
+  void begin_turn();
+
+  /**
+   * @brief Start of the current turn, or 0 if there is none.
+   */
+  gint64 turn_started() const { return t_turn; }
+
+  /**
+   * @brief Write the events of the current turn to a new trace file, in the
+   * background. Does nothing if no turn is in progress. Main thread only.
+   */
+  void end_turn();
+
+private:
+  struct TraceEvent {
+    char phase;
+    const char *name;
+    gint64 ts;
+    gint64 dur;
+    pid_t tid;
+  };
+
+  const bool is_enabled;
+  const std::string dir;
+  const size_t max_files;
+  gint64 t_turn = 0;
+
+  std::mutex mutex;
+  std::deque<TraceEvent> events;
+  std::map<pid_t, std::string> thread_names;
+
+  void record(char phase, const char *name, gint64 ts, gint64 t_end);
+  GBytes *build_trace(gint64 t_from);
+  void prune();
+
+  static void on_write_done(GObject *source, GAsyncResult *result,
+                            gpointer data);
+};
+
+/**
+ * @brief Record a span over the lifetime of the object, for synchronous
+ * scopes.
+ */
+class TraceSpan {
+public:
+  TraceSpan(Tracer *tracer, const char *name)
+      : tracer(tracer), name(name), t_start(tracer->now()) {}
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+  ~TraceSpan() {
+    if (t_start)
+      tracer->span(name, t_start);
+  }
+
+private:
+  Tracer *const tracer;
+  const char *const name;
+  const gint64 t_start;
+};
+
+} // namespace genie
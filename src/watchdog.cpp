@@ -0,0 +1,221 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "watchdog.hpp"
+#include "app.hpp"
+#include "metrics.hpp"
+
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::Watchdog"
+
+// signal interrupting the main thread to capture its backtrace
+static const int BACKTRACE_SIGNAL = SIGUSR2;
+
+// how long to wait for the main thread to handle the signal
+static const int BACKTRACE_TIMEOUT_MS = 100;
+
+static const std::vector<double> STALL_BOUNDS = {0.05, 0.1, 0.25, 0.5, 1,
+                                                 2.5,  5,   10,   30};
+
+static void *backtrace_frames[genie::Watchdog::MAX_FRAMES];
+static std::atomic<int> backtrace_depth{-1};
+
+static void on_backtrace_signal(int signum) {
+  int saved_errno = errno;
+  int depth = backtrace(backtrace_frames, genie::Watchdog::MAX_FRAMES);
+  backtrace_depth.store(depth, std::memory_order_release);
+  errno = saved_errno;
+}
+
+genie::Watchdog::Watchdog(App *app, size_t stall_ms)
+    : app(app), stall_us(stall_ms * 1000),
+      stall_metric(app->metrics->histogram(
+          "genie_main_loop_stall_seconds",
+          "Time the main loop was blocked, for stalls longer than the "
+          "watchdog threshold, in seconds.",
+          "", STALL_BOUNDS)) {
+  const char *watchdog_usec = g_getenv("WATCHDOG_USEC");
+  const char *watchdog_pid = g_getenv("WATCHDOG_PID");
+  const char *socket_path = g_getenv("NOTIFY_SOCKET");
+  if (watchdog_usec && socket_path &&
+      (!watchdog_pid || atoi(watchdog_pid) == getpid())) {
+    systemd_us = g_ascii_strtoll(watchdog_usec, nullptr, 10);
+    notify_socket = socket_path;
+  }
+  if (systemd_us > 0 && notify_socket.size() < sizeof(sockaddr_un::sun_path)) {
+    notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (notify_fd < 0)
+      g_warning("Failed to open the systemd notification socket: %s",
+                strerror(errno));
+  }
+
+  // the heartbeat must come well within both the stall threshold and the
+  // systemd interval
+  if (stall_us)
+    interval_us = stall_us / 2;
+  if (notify_fd >= 0 && (!interval_us || systemd_us / 4 < interval_us))
+    interval_us = systemd_us / 4;
+}
+
+genie::Watchdog::~Watchdog() {
+  if (thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    cond.notify_one();
+    thread.join();
+  }
+  if (heartbeat_source)
+    g_source_remove(heartbeat_source);
+  if (notify_fd >= 0)
+    close(notify_fd);
+}
+
+void genie::Watchdog::start() {
+  if (!interval_us)
+    return;
+
+  main_thread = pthread_self();
+  if (stall_us) {
+    // the first call loads the unwinder, which is not safe in a signal
+    // handler
+    void *frame;
+    backtrace(&frame, 1);
+
+    struct sigaction action = {};
+    action.sa_handler = on_backtrace_signal;
+    // restarts most interrupted system calls, such as reads and writes, but
+    // sleeps and polls still return early with EINTR: the main thread must
+    // sleep with g_usleep(), which resumes after a signal
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(BACKTRACE_SIGNAL, &action, nullptr);
+  }
+
+  last_beat.store(g_get_monotonic_time(), std::memory_order_relaxed);
+  heartbeat_source = g_timeout_add_full(G_PRIORITY_HIGH, interval_us / 1000,
+                                        heartbeat, this, nullptr);
+  thread = std::thread(&Watchdog::loop, this);
+
+  if (stall_us)
+    g_message("Watching the main loop for stalls over %" G_GINT64_FORMAT
+              " ms",
+              stall_us / 1000);
+  if (notify_fd >= 0)
+    g_message("Notifying the systemd watchdog every %" G_GINT64_FORMAT " ms",
+              interval_us / 1000);
+}
+
+/**
+ * @brief Store a heartbeat, and record the stall that delayed it, if any.
+ * Runs on the main thread.
+ */
+gboolean genie::Watchdog::heartbeat(gpointer data) {
+  Watchdog *self = static_cast<Watchdog *>(data);
+  gint64 now = g_get_monotonic_time();
+  gint64 beat = self->last_beat.load(std::memory_order_relaxed);
+  gint64 late_us = now - beat - self->interval_us;
+
+  if (self->stall_us && late_us > self->stall_us) {
+    g_warning("Main loop was blocked for %" G_GINT64_FORMAT " ms",
+              late_us / 1000);
+    self->stall_metric->observe(late_us / (double)G_USEC_PER_SEC);
+    self->app->tracer->span("main.stall", beat + self->interval_us, now);
+  }
+
+  self->last_beat.store(now, std::memory_order_relaxed);
+  return G_SOURCE_CONTINUE;
+}
+
+void genie::Watchdog::loop() {
+  pthread_setname_np(pthread_self(), "watchdog");
+
+  gint64 reported_beat = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!cond.wait_for(lock, std::chrono::microseconds(interval_us),
+                        [this] { return stopping; })) {
+    gint64 beat = last_beat.load(std::memory_order_relaxed);
+    gint64 late_us = g_get_monotonic_time() - beat - interval_us;
+
+    // one backtrace per stall
+    if (stall_us && late_us > stall_us && beat != reported_beat) {
+      reported_beat = beat;
+      report_stall(late_us);
+    }
+    if (notify_fd >= 0 && late_us < systemd_us / 2)
+      notify_systemd();
+  }
+}
+
+/**
+ * @brief Capture and log the backtrace of the main thread, while it is
+ * blocked.
+ */
+void genie::Watchdog::report_stall(gint64 late_us) {
+  app->recorder->record_event("watchdog", "stall");
+
+  backtrace_depth.store(-1, std::memory_order_relaxed);
+  pthread_kill(main_thread, BACKTRACE_SIGNAL);
+  int depth = -1;
+  for (int i = 0; i < BACKTRACE_TIMEOUT_MS && depth < 0; i++) {
+    usleep(1000);
+    depth = backtrace_depth.load(std::memory_order_acquire);
+  }
+
+  if (depth < 0) {
+    g_warning("Main loop blocked for %" G_GINT64_FORMAT
+              " ms, could not capture the backtrace",
+              late_us / 1000);
+    return;
+  }
+
+  g_warning("Main loop blocked for %" G_GINT64_FORMAT " ms, in:",
+            late_us / 1000);
+  // the first frame is the signal handler
+  char **symbols = backtrace_symbols(backtrace_frames, depth);
+  for (int i = 1; symbols && i < depth; i++)
+    g_warning("  #%d %s", i - 1, symbols[i]);
+  free(symbols);
+}
+
+void genie::Watchdog::notify_systemd() {
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, notify_socket.data(), notify_socket.size());
+  // a leading '@' stands for the abstract namespace
+  if (addr.sun_path[0] == '@')
+    addr.sun_path[0] = '\0';
+  socklen_t length = offsetof(struct sockaddr_un, sun_path) +
+                     notify_socket.size();
+
+  static const char message[] = "WATCHDOG=1";
+  if (sendto(notify_fd, message, sizeof(message) - 1, MSG_NOSIGNAL,
+             (struct sockaddr *)&addr, length) < 0)
+    g_debug("Failed to notify the systemd watchdog: %s", strerror(errno));
+}
@@ -0,0 +1,91 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <glib.h>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <thread>
+
+namespace genie {
+
+class App;
+class Histogram;
+
+/**
+ * @brief Watches the main loop from a separate thread.
+ *
+ * A high priority timeout on the main loop stores a heartbeat. When the
+ * heartbeat is late by more than the stall threshold, the watchdog thread
+ * interrupts the main thread with a signal to capture and log its
+ * backtrace, which points at the call blocking the loop. When the loop comes
+ * back, the duration of the stall goes to the
+ * `genie_main_loop_stall_seconds` histogram and to the trace.
+ *
+ * When run by systemd with `WatchdogSec=`, the watchdog also sends
+ * `WATCHDOG=1` while the main loop is responsive, so that systemd restarts
+ * the client if it hangs.
+ */
+class Watchdog {
+public:
+  // maximum depth of the captured backtraces
+  static const int MAX_FRAMES = 64;
+
+  /**
+   * @brief Construct a watchdog reporting stalls longer than `stall_ms`, or
+   * none if `stall_ms` is 0.
+   */
+  Watchdog(App *app, size_t stall_ms);
+  ~Watchdog();
+
+  /**
+   * @brief Start the heartbeat and the watchdog thread. Must be called from
+   * the main thread, right before running the main loop.
+   */
+  void start();
+
+private:
+  App *const app;
+  const gint64 stall_us;
+  // interval of the systemd watchdog, 0 if not run by systemd with one
+  gint64 systemd_us = 0;
+  int notify_fd = -1;
+  std::string notify_socket;
+  gint64 interval_us = 0;
+  Histogram *stall_metric;
+
+  pthread_t main_thread;
+  guint heartbeat_source = 0;
+  std::atomic<gint64> last_beat{0};
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool stopping = false;
+
+  static gboolean heartbeat(gpointer data);
+  void loop();
+  void report_stall(gint64 late_us);
+  void notify_systemd();
+};
+
+} // namespace genie
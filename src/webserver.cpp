@@ -18,6 +18,9 @@
 
 #include "webserver.hpp"
 #include "app.hpp"
+#include "audio/audioplayer.hpp"
+#include "metrics.hpp"
+#include "stats.hpp"
 #include "string.h"
 #include "utils/c-style-callback.hpp"
 #include "utils/soup-utils.hpp"
@@ -128,6 +131,39 @@ genie::WebServer::WebServer(App *app)
         self->handle_oauth_redirect(msg, query);
       },
       this, nullptr);
+  soup_server_add_handler(
+      server.get(), "/stats",
+      [](SoupServer *server, SoupMessage *msg, const char *path,
+         GHashTable *query, SoupClientContext *context, gpointer data) {
+        WebServer *self = static_cast<WebServer *>(data);
+        if (strcmp(path, "/stats") == 0)
+          self->handle_stats(msg);
+        else
+          self->handle_404(msg, path);
+      },
+      this, nullptr);
+  soup_server_add_handler(
+      server.get(), "/metrics",
+      [](SoupServer *server, SoupMessage *msg, const char *path,
+         GHashTable *query, SoupClientContext *context, gpointer data) {
+        WebServer *self = static_cast<WebServer *>(data);
+        if (strcmp(path, "/metrics") == 0)
+          self->handle_metrics(msg);
+        else
+          self->handle_404(msg, path);
+      },
+      this, nullptr);
+  soup_server_add_handler(
+      server.get(), "/recorder",
+      [](SoupServer *server, SoupMessage *msg, const char *path,
+         GHashTable *query, SoupClientContext *context, gpointer data) {
+        WebServer *self = static_cast<WebServer *>(data);
+        if (strcmp(path, "/recorder") == 0)
+          self->handle_recorder(msg);
+        else
+          self->handle_404(msg, path);
+      },
+      this, nullptr);
   soup_server_add_handler(
       server.get(), "/network",
       [](SoupServer *server, SoupMessage *msg, const char *path,
@@ -199,6 +235,85 @@ void genie::WebServer::handle_asset(SoupMessage *msg, const char *path) {
                             length);
 }
 
+void genie::WebServer::handle_stats(SoupMessage *msg) {
+  if (check_method(msg, "/stats", (int)AllowedMethod::GET) ==
+      AllowedMethod::NONE)
+    return;
+
+  auto_gobject_ptr<JsonBuilder> builder(json_builder_new(), adopt_mode::owned);
+  json_builder_begin_object(builder.get());
+  app->stats->to_json(builder.get());
+  json_builder_end_object(builder.get());
+
+  auto_gobject_ptr<JsonGenerator> gen(json_generator_new(), adopt_mode::owned);
+  JsonNode *root = json_builder_get_root(builder.get());
+  json_generator_set_root(gen.get(), root);
+  json_node_unref(root);
+  gsize length;
+  gchar *json_text = json_generator_to_data(gen.get(), &length);
+
+  log_request(msg, "/stats", 200);
+  soup_message_set_status(msg, 200);
+  soup_message_set_response(msg, "application/json", SOUP_MEMORY_TAKE,
+                            json_text, length);
+}
+
+/**
+ * @brief Export the metrics in the Prometheus text format.
+ */
+void genie::WebServer::handle_metrics(SoupMessage *msg) {
+  if (check_method(msg, "/metrics", (int)AllowedMethod::GET) ==
+      AllowedMethod::NONE)
+    return;
+
+  app->audio_player->update_metrics();
+  std::string text = app->metrics->render();
+
+  log_request(msg, "/metrics", 200);
+  soup_message_set_status(msg, 200);
+  soup_message_set_response(msg, "text/plain; version=0.0.4",
+                            SOUP_MEMORY_COPY, text.c_str(), text.size());
+}
+
+/**
+ * @brief Dump the flight recorder on request, to report a problem.
+ */
+void genie::WebServer::handle_recorder(SoupMessage *msg) {
+  if (check_method(msg, "/recorder", (int)AllowedMethod::POST) ==
+      AllowedMethod::NONE)
+    return;
+
+  if (g_strcmp0(
+          soup_message_headers_get_content_type(msg->request_headers, nullptr),
+          "application/x-www-form-urlencoded") != 0) {
+    log_request(msg, "/recorder", 406);
+    send_html(msg, 406, title_error, "<h1>Not Acceptable</h1>");
+    return;
+  }
+
+  GHashTable *fields = soup_form_decode(msg->request_body->data);
+  if (g_strcmp0((const char *)g_hash_table_lookup(fields, "_csrf"),
+                csrf_token.c_str()) != 0) {
+    log_request(msg, "/recorder", 403);
+    send_html(msg, 403, title_error, "<h1>Invalid CSRF token</h1>");
+  } else {
+    std::string path = app->recorder->dump("manual", true);
+    std::string body;
+    if (path.empty()) {
+      body = "<h1>Flight recorder disabled</h1>";
+    } else {
+      gchar *escaped = g_markup_escape_text(path.c_str(), -1);
+      body = std::string("<h1>Flight recording saved</h1><p>") + escaped +
+             "</p>";
+      g_free(escaped);
+    }
+    log_request(msg, "/recorder", 200);
+    send_html(msg, 200, title_normal, body.c_str());
+  }
+
+  g_hash_table_unref(fields);
+}
+
 void genie::WebServer::handle_404(SoupMessage *msg, const char *path) {
   log_request(msg, path, 404);
   send_html(msg, 404, title_error, reply_404);
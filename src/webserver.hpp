@@ -56,6 +56,9 @@ private:
   void handle_net_get(SoupMessage *msg);
   void handle_net_post(SoupMessage *msg);
   void handle_oauth_redirect(SoupMessage *msg, GHashTable *query);
+  void handle_stats(SoupMessage *msg);
+  void handle_metrics(SoupMessage *msg);
+  void handle_recorder(SoupMessage *msg);
   void handle_404(SoupMessage *msg, const char *path);
   void handle_405(SoupMessage *msg, const char *path);
 };
@@ -129,8 +129,8 @@ void genie::conversation::AudioProtocol::handle_check(int64_t req,
     access_token = json_reader_get_string_value(reader);
     json_reader_end_member(reader);
 
-    app->dispatch(new genie::state::events::audio::CheckSpotifyEvent(
-        std::move(request), username, access_token));
+    app->dispatch<genie::state::events::audio::CheckSpotifyEvent>(
+        std::move(request), username, access_token);
   } else if (strcmp(type, "url") == 0) {
 
     // we can always play URLs
@@ -172,8 +172,8 @@ void genie::conversation::AudioProtocol::handle_prepare(int64_t req,
       access_token = json_reader_get_string_value(reader);
       json_reader_end_member(reader);
 
-      app->dispatch(
-          new state::events::SpotifyCredentials(username, access_token));
+      app->dispatch<state::events::SpotifyCredentials>(username, access_token,
+                                                       true);
     } else if (strcmp(type, "url") == 0) {
       // nothing to do
     } else if (strcmp(type, "custom") == 0) {
@@ -184,31 +184,28 @@ void genie::conversation::AudioProtocol::handle_prepare(int64_t req,
     }
   }
 
-  app->dispatch(new state::events::audio::PrepareEvent(std::move(request)));
+  app->dispatch<state::events::audio::PrepareEvent>(std::move(request));
 }
 
 void genie::conversation::AudioProtocol::handle_stop(int64_t req,
                                                      JsonReader *reader) {
   auto request = std::make_unique<SimpleAudioResponse>(client, req);
 
-  app->dispatch(new state::events::audio::StopEvent(std::move(request)));
+  app->dispatch<state::events::audio::StopEvent>(std::move(request));
 }
 
 void genie::conversation::AudioProtocol::handle_pause(int64_t req,
                                                       JsonReader *reader) {
   auto request = std::make_unique<SimpleAudioResponse>(client, req);
 
-  // TODO handle pause differently than stop
-  app->dispatch(new state::events::audio::StopEvent(std::move(request)));
+  app->dispatch<state::events::audio::PauseEvent>(std::move(request));
 }
 
 void genie::conversation::AudioProtocol::handle_resume(int64_t req,
                                                        JsonReader *reader) {
   auto request = std::make_unique<SimpleAudioResponse>(client, req);
 
-  // TODO implement resume
-  // this is enough to get resume in spotify but not news/radio
-  request->resolve();
+  app->dispatch<state::events::audio::ResumeEvent>(std::move(request));
 }
 
 void genie::conversation::AudioProtocol::handle_play_urls(int64_t req,
@@ -231,8 +228,8 @@ void genie::conversation::AudioProtocol::handle_play_urls(int64_t req,
   }
 
   json_reader_end_member(reader); // end urls
-  app->dispatch(new state::events::audio::PlayURLsEvent(std::move(request),
-                                                        std::move(urls)));
+  app->dispatch<state::events::audio::PlayURLsEvent>(std::move(request),
+                                                     std::move(urls));
 }
 
 void genie::conversation::AudioProtocol::handle_set_volume(int64_t req,
@@ -244,8 +241,8 @@ void genie::conversation::AudioProtocol::handle_set_volume(int64_t req,
   int volume = json_reader_get_int_value(reader);
   json_reader_end_member(reader);
 
-  app->dispatch(
-      new state::events::audio::SetVolumeEvent(std::move(request), volume));
+  app->dispatch<state::events::audio::SetVolumeEvent>(std::move(request),
+                                                      volume);
 }
 
 void genie::conversation::AudioProtocol::handle_adj_volume(int64_t req,
@@ -257,8 +254,8 @@ void genie::conversation::AudioProtocol::handle_adj_volume(int64_t req,
   int delta = json_reader_get_int_value(reader);
   json_reader_end_member(reader);
 
-  app->dispatch(
-      new state::events::audio::AdjVolumeEvent(std::move(request), delta));
+  app->dispatch<state::events::audio::AdjVolumeEvent>(std::move(request),
+                                                      delta);
 }
 
 void genie::conversation::AudioProtocol::handle_set_mute(int64_t req,
@@ -269,8 +266,7 @@ void genie::conversation::AudioProtocol::handle_set_mute(int64_t req,
   bool mute = json_reader_get_boolean_value(reader);
   json_reader_end_member(reader);
 
-  app->dispatch(
-      new state::events::audio::SetMuteEvent(std::move(request), mute));
+  app->dispatch<state::events::audio::SetMuteEvent>(std::move(request), mute);
 }
 
 genie::conversation::BaseAudioRequest::~BaseAudioRequest() {
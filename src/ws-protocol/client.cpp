@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "../metrics.hpp"
 #include "../spotifyd.hpp"
 #include "../utils/c-style-callback.hpp"
 #include "../utils/soup-utils.hpp"
@@ -290,6 +291,10 @@ gboolean genie::conversation::Client::retry_connect_timer(gpointer data) {
 }
 
 void genie::conversation::Client::retry_connect() {
+  app->metrics
+      ->counter("genie_conversation_reconnects_total",
+                "Reconnections of the Genie websocket.")
+      ->inc();
   g_timeout_add(app->config->retry_interval, retry_connect_timer, this);
 }
 
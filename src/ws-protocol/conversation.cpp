@@ -119,7 +119,7 @@ void genie::conversation::ConversationProtocol::handleText(gint64 id,
     return;
   }
 
-  app->dispatch(new state::events::TextMessage(id, text));
+  app->dispatch<state::events::TextMessage>(id, text);
   ask_special_text_id = id;
   last_said_text_id = id;
 }
@@ -133,12 +133,11 @@ void genie::conversation::ConversationProtocol::handleSound(
   if (strcmp(name, "news-intro") == 0) {
     g_debug("Dispatching sound message id=%" G_GINT64_FORMAT " name=%s", id,
             name);
-    app->dispatch(new state::events::SoundMessage(Sound_t::NEWS_INTRO));
+    app->dispatch<state::events::SoundMessage>(Sound_t::NEWS_INTRO);
   } else if (strcmp(name, "alarm-clock-elapsed") == 0) {
     g_debug("Dispatching sound message id=%" G_GINT64_FORMAT " name=%s", id,
             name);
-    app->dispatch(
-        new state::events::SoundMessage(Sound_t::ALARM_CLOCK_ELAPSED));
+    app->dispatch<state::events::SoundMessage>(Sound_t::ALARM_CLOCK_ELAPSED);
   } else {
     g_warning("Sound not recognized id=%" G_GINT64_FORMAT " name=%s", id, name);
   }
@@ -150,7 +149,7 @@ void genie::conversation::ConversationProtocol::handleAudio(
   const gchar *url = json_reader_get_string_value(reader);
   json_reader_end_member(reader);
   g_debug("Dispatching type=audio id=%" G_GINT64_FORMAT " url=%s", id, url);
-  app->dispatch(new state::events::AudioMessage(url));
+  app->dispatch<state::events::AudioMessage>(url);
 }
 
 void genie::conversation::ConversationProtocol::handleError(
@@ -170,7 +169,7 @@ void genie::conversation::ConversationProtocol::handleAskSpecial(
   json_reader_end_member(reader);
   g_debug("Disptaching type=askSpecial ask=%s for text id=%" G_GINT64_FORMAT,
           ask, ask_special_text_id);
-  app->dispatch(new state::events::AskSpecialMessage(ask, ask_special_text_id));
+  app->dispatch<state::events::AskSpecialMessage>(ask, ask_special_text_id);
   if (ask_special_text_id != -1) {
     ask_special_text_id = -1;
   }
@@ -220,8 +219,7 @@ void genie::conversation::ConversationProtocol::handleNewDevice(
     json_reader_end_member(reader);
 
     if (access_token && username) {
-      app->dispatch(
-          new state::events::SpotifyCredentials(username, access_token));
+      app->dispatch<state::events::SpotifyCredentials>(username, access_token);
     }
   }
 